@@ -0,0 +1,471 @@
+//
+//  argon2.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 15/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "argon2.hpp"
+
+#include <memory>
+#include <stdexcept>
+#include <algorithm>
+#include "parallel.hpp"
+
+namespace {
+  constexpr uint64_t BLAKE2B_IV[8] = {
+    0x6A09E667F3BCC908, 0xBB67AE8584CAA73B,
+    0x3C6EF372FE94F82B, 0xA54FF53A5F1D36F1,
+    0x510E527FADE682D1, 0x9B05688C2B3E6C1F,
+    0x1F83D9ABFB41BD6B, 0x5BE0CD19137E2179
+  };
+  
+  //The message words used by each round. The last two rounds reuse the first
+  //two rows
+  constexpr size_t BLAKE2B_SIGMA[10][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0}
+  };
+  
+  constexpr size_t BLAKE2B_BLOCK_SIZE = 128;
+  constexpr size_t BLAKE2B_OUT_SIZE = 64;
+  
+  uint64_t rotr(const uint64_t x, const int n) {
+    return (x >> n) | (x << (64 - n));
+  }
+  
+  uint64_t load64(const uint8_t *bytes) {
+    uint64_t word = 0;
+    for (size_t i = 0; i != sizeof(uint64_t); ++i) {
+      word |= uint64_t(bytes[i]) << (i * 8);
+    }
+    return word;
+  }
+  
+  void store64(uint8_t *bytes, const uint64_t word) {
+    for (size_t i = 0; i != sizeof(uint64_t); ++i) {
+      bytes[i] = static_cast<uint8_t>(word >> (i * 8));
+    }
+  }
+  
+  void store32(uint8_t *bytes, const uint32_t word) {
+    for (size_t i = 0; i != sizeof(uint32_t); ++i) {
+      bytes[i] = static_cast<uint8_t>(word >> (i * 8));
+    }
+  }
+  
+  //Unkeyed BLAKE2b with an output of up to 64 bytes
+  class Blake2b {
+  public:
+    explicit Blake2b(const size_t outSize)
+      : outSize(outSize) {
+      std::copy(std::begin(BLAKE2B_IV), std::end(BLAKE2B_IV), state);
+      state[0] ^= 0x01010000 ^ outSize;
+    }
+    
+    void update(const uint8_t *bytes, size_t size) {
+      while (size != 0) {
+        //the last block is compressed differently so a full buffer is only
+        //compressed once there is more input
+        if (bufferSize == BLAKE2B_BLOCK_SIZE) {
+          counter += BLAKE2B_BLOCK_SIZE;
+          compress(false);
+          bufferSize = 0;
+        }
+        const size_t copied = std::min(size, BLAKE2B_BLOCK_SIZE - bufferSize);
+        std::copy(bytes, bytes + copied, buffer + bufferSize);
+        bufferSize += copied;
+        bytes += copied;
+        size -= copied;
+      }
+    }
+    
+    void update32(const uint32_t word) {
+      uint8_t bytes[sizeof(uint32_t)];
+      store32(bytes, word);
+      update(bytes, sizeof(bytes));
+    }
+    
+    void finalize(uint8_t *out) {
+      counter += bufferSize;
+      std::fill(buffer + bufferSize, buffer + BLAKE2B_BLOCK_SIZE, 0);
+      compress(true);
+      uint8_t bytes[BLAKE2B_OUT_SIZE];
+      for (size_t i = 0; i != 8; ++i) {
+        store64(bytes + i * sizeof(uint64_t), state[i]);
+      }
+      std::copy(bytes, bytes + outSize, out);
+    }
+  
+  private:
+    uint64_t state[8];
+    uint8_t buffer[BLAKE2B_BLOCK_SIZE];
+    size_t bufferSize = 0;
+    uint64_t counter = 0;
+    size_t outSize;
+    
+    void compress(const bool last) {
+      uint64_t m[16];
+      for (size_t i = 0; i != 16; ++i) {
+        m[i] = load64(buffer + i * sizeof(uint64_t));
+      }
+      uint64_t v[16];
+      std::copy(state, state + 8, v);
+      std::copy(std::begin(BLAKE2B_IV), std::end(BLAKE2B_IV), v + 8);
+      v[12] ^= counter;
+      if (last) {
+        v[14] = ~v[14];
+      }
+      
+      auto g = [&v] (
+        const size_t a, const size_t b, const size_t c, const size_t d,
+        const uint64_t x, const uint64_t y
+      ) {
+        v[a] += v[b] + x;
+        v[d] = rotr(v[d] ^ v[a], 32);
+        v[c] += v[d];
+        v[b] = rotr(v[b] ^ v[c], 24);
+        v[a] += v[b] + y;
+        v[d] = rotr(v[d] ^ v[a], 16);
+        v[c] += v[d];
+        v[b] = rotr(v[b] ^ v[c], 63);
+      };
+      
+      for (size_t r = 0; r != 12; ++r) {
+        const size_t *s = BLAKE2B_SIGMA[r % 10];
+        g(0, 4, 8, 12, m[s[0]], m[s[1]]);
+        g(1, 5, 9, 13, m[s[2]], m[s[3]]);
+        g(2, 6, 10, 14, m[s[4]], m[s[5]]);
+        g(3, 7, 11, 15, m[s[6]], m[s[7]]);
+        g(0, 5, 10, 15, m[s[8]], m[s[9]]);
+        g(1, 6, 11, 12, m[s[10]], m[s[11]]);
+        g(2, 7, 8, 13, m[s[12]], m[s[13]]);
+        g(3, 4, 9, 14, m[s[14]], m[s[15]]);
+      }
+      
+      for (size_t i = 0; i != 8; ++i) {
+        state[i] ^= v[i] ^ v[i + 8];
+      }
+    }
+  };
+  
+  //H' from the RFC. A hash of any length built from a chain of BLAKE2b
+  //hashes
+  void hashLong(
+    uint8_t *out,
+    const size_t outSize,
+    const uint8_t *in,
+    const size_t inSize
+  ) {
+    if (outSize <= BLAKE2B_OUT_SIZE) {
+      Blake2b hasher(outSize);
+      hasher.update32(static_cast<uint32_t>(outSize));
+      hasher.update(in, inSize);
+      hasher.finalize(out);
+      return;
+    }
+    
+    constexpr size_t HALF = BLAKE2B_OUT_SIZE / 2;
+    uint8_t v[BLAKE2B_OUT_SIZE];
+    Blake2b first(BLAKE2B_OUT_SIZE);
+    first.update32(static_cast<uint32_t>(outSize));
+    first.update(in, inSize);
+    first.finalize(v);
+    
+    //the first half of each hash is output until the rest fits in one hash
+    size_t remaining = outSize;
+    while (remaining > BLAKE2B_OUT_SIZE) {
+      std::copy(v, v + HALF, out);
+      out += HALF;
+      remaining -= HALF;
+      const size_t nextSize = std::min(remaining, BLAKE2B_OUT_SIZE);
+      Blake2b next(nextSize);
+      next.update(v, BLAKE2B_OUT_SIZE);
+      next.finalize(v);
+    }
+    std::copy(v, v + remaining, out);
+  }
+  
+  constexpr size_t BLOCK_WORDS = 128;
+  constexpr size_t BLOCK_SIZE = BLOCK_WORDS * sizeof(uint64_t);
+  constexpr size_t SYNC_POINTS = 4;
+  constexpr uint32_t VERSION = 0x13;
+  constexpr uint32_t TYPE_ID = 2;
+  constexpr size_t SEED_SIZE = 64;
+  
+  struct alignas(64) Block {
+    uint64_t v[BLOCK_WORDS];
+  };
+  
+  //BLAKE2b's G with the additions replaced by x + y + 2 * lo(x) * lo(y)
+  inline void mix(uint64_t &a, uint64_t &b, uint64_t &c, uint64_t &d) {
+    auto blaMka = [] (const uint64_t x, const uint64_t y) {
+      return x + y + 2 * (x & 0xFFFFFFFF) * (y & 0xFFFFFFFF);
+    };
+    a = blaMka(a, b);
+    d = rotr(d ^ a, 32);
+    c = blaMka(c, d);
+    b = rotr(b ^ c, 24);
+    a = blaMka(a, b);
+    d = rotr(d ^ a, 16);
+    c = blaMka(c, d);
+    b = rotr(b ^ c, 63);
+  }
+  
+  //The BLAKE2b round without a message applied to 16 words of a block. Word k
+  //is at words[(k / 2) * pairStride + k % 2]
+  __attribute__((always_inline))
+  inline void permute(uint64_t *words, const size_t pairStride) {
+    uint64_t v[16];
+    for (size_t k = 0; k != 16; ++k) {
+      v[k] = words[(k / 2) * pairStride + k % 2];
+    }
+    mix(v[0], v[4], v[8], v[12]);
+    mix(v[1], v[5], v[9], v[13]);
+    mix(v[2], v[6], v[10], v[14]);
+    mix(v[3], v[7], v[11], v[15]);
+    mix(v[0], v[5], v[10], v[15]);
+    mix(v[1], v[6], v[11], v[12]);
+    mix(v[2], v[7], v[8], v[13]);
+    mix(v[3], v[4], v[9], v[14]);
+    for (size_t k = 0; k != 16; ++k) {
+      words[(k / 2) * pairStride + k % 2] = v[k];
+    }
+  }
+  
+  //The compression function G. The result is XORed with the next block
+  //instead of overwriting it on every pass after the first
+  void fillBlock(
+    const Block &prev,
+    const Block &ref,
+    Block &next,
+    const bool withXor
+  ) {
+    Block r;
+    Block tmp;
+    for (size_t i = 0; i != BLOCK_WORDS; ++i) {
+      r.v[i] = prev.v[i] ^ ref.v[i];
+    }
+    tmp = r;
+    if (withXor) {
+      for (size_t i = 0; i != BLOCK_WORDS; ++i) {
+        tmp.v[i] ^= next.v[i];
+      }
+    }
+    //rows of 16 words then columns of 8 pairs of words
+    for (size_t i = 0; i != 8; ++i) {
+      permute(r.v + i * 16, 2);
+    }
+    for (size_t i = 0; i != 8; ++i) {
+      permute(r.v + i * 2, 16);
+    }
+    for (size_t i = 0; i != BLOCK_WORDS; ++i) {
+      next.v[i] = tmp.v[i] ^ r.v[i];
+    }
+  }
+  
+  class Instance {
+  public:
+    Instance(const Argon2Cost &cost)
+      : passes(cost.passes),
+        lanes(cost.lanes),
+        //the memory is rounded down to a multiple of 4 blocks per lane
+        laneLength(cost.memory / (SYNC_POINTS * cost.lanes) * SYNC_POINTS),
+        segmentLength(laneLength / SYNC_POINTS),
+        memory(new Block[laneLength * lanes]) {}
+    
+    void init(const uint8_t *seed) {
+      uint8_t input[SEED_SIZE + 2 * sizeof(uint32_t)];
+      std::copy(seed, seed + SEED_SIZE, input);
+      uint8_t bytes[BLOCK_SIZE];
+      for (uint32_t l = 0; l != lanes; ++l) {
+        store32(input + SEED_SIZE + sizeof(uint32_t), l);
+        for (uint32_t i = 0; i != 2; ++i) {
+          store32(input + SEED_SIZE, i);
+          hashLong(bytes, BLOCK_SIZE, input, sizeof(input));
+          Block &block = at(l, i);
+          for (size_t w = 0; w != BLOCK_WORDS; ++w) {
+            block.v[w] = load64(bytes + w * sizeof(uint64_t));
+          }
+        }
+      }
+    }
+    
+    //The lanes of a slice don't depend on each other so each lane is filled
+    //on its own thread
+    void fill() {
+      for (uint32_t pass = 0; pass != passes; ++pass) {
+        for (uint32_t slice = 0; slice != SYNC_POINTS; ++slice) {
+          parallelFor(lanes, [this, pass, slice] (const size_t lane) {
+            fillSegment(pass, slice, static_cast<uint32_t>(lane));
+          });
+        }
+      }
+    }
+    
+    void finalize(uint8_t *out, const size_t outSize) {
+      Block last = at(0, laneLength - 1);
+      for (uint32_t l = 1; l != lanes; ++l) {
+        const Block &block = at(l, laneLength - 1);
+        for (size_t w = 0; w != BLOCK_WORDS; ++w) {
+          last.v[w] ^= block.v[w];
+        }
+      }
+      uint8_t bytes[BLOCK_SIZE];
+      for (size_t w = 0; w != BLOCK_WORDS; ++w) {
+        store64(bytes + w * sizeof(uint64_t), last.v[w]);
+      }
+      hashLong(out, outSize, bytes, BLOCK_SIZE);
+    }
+  
+  private:
+    uint32_t passes;
+    uint32_t lanes;
+    uint32_t laneLength;
+    uint32_t segmentLength;
+    std::unique_ptr<Block []> memory;
+    
+    Block &at(const uint32_t lane, const uint32_t index) {
+      return memory[size_t(lane) * laneLength + index];
+    }
+    
+    //Maps a pseudo random number to a block that has already been filled
+    uint32_t refIndex(
+      const uint32_t pass,
+      const uint32_t slice,
+      const uint32_t index,
+      const uint32_t rand,
+      const bool sameLane
+    ) const {
+      //blocks in the current segment of other lanes are still being filled
+      uint32_t areaSize;
+      if (pass == 0) {
+        areaSize = slice * segmentLength;
+      } else {
+        areaSize = laneLength - segmentLength;
+      }
+      if (sameLane) {
+        areaSize += index - 1;
+      } else if (index == 0) {
+        areaSize -= 1;
+      }
+      
+      uint64_t relative = rand;
+      relative = (relative * relative) >> 32;
+      relative = areaSize - 1 - ((areaSize * relative) >> 32);
+      
+      uint32_t start = 0;
+      if (pass != 0 && slice != SYNC_POINTS - 1) {
+        start = (slice + 1) * segmentLength;
+      }
+      return static_cast<uint32_t>((start + relative) % laneLength);
+    }
+    
+    void fillSegment(
+      const uint32_t pass,
+      const uint32_t slice,
+      const uint32_t lane
+    ) {
+      //the first half of the first pass uses addresses that don't depend on
+      //the password to resist side channels
+      const bool independent = pass == 0 && slice < SYNC_POINTS / 2;
+      Block zero = {};
+      Block input = {};
+      Block addresses;
+      input.v[0] = pass;
+      input.v[1] = lane;
+      input.v[2] = slice;
+      input.v[3] = size_t(laneLength) * lanes;
+      input.v[4] = passes;
+      input.v[5] = TYPE_ID;
+      auto nextAddresses = [&] {
+        ++input.v[6];
+        fillBlock(zero, input, addresses, false);
+        fillBlock(zero, addresses, addresses, false);
+      };
+      
+      uint32_t begin = 0;
+      if (pass == 0 && slice == 0) {
+        //the first two blocks were filled by init
+        begin = 2;
+        if (independent) {
+          nextAddresses();
+        }
+      }
+      
+      for (uint32_t i = begin; i != segmentLength; ++i) {
+        const uint32_t index = slice * segmentLength + i;
+        const uint32_t prevIndex = index == 0 ? laneLength - 1 : index - 1;
+        
+        uint64_t rand;
+        if (independent) {
+          if (i % BLOCK_WORDS == 0) {
+            nextAddresses();
+          }
+          rand = addresses.v[i % BLOCK_WORDS];
+        } else {
+          rand = at(lane, prevIndex).v[0];
+        }
+        
+        uint32_t refLane = static_cast<uint32_t>((rand >> 32) % lanes);
+        if (pass == 0 && slice == 0) {
+          refLane = lane;
+        }
+        const uint32_t ref = refIndex(
+          pass, slice, i, static_cast<uint32_t>(rand), refLane == lane
+        );
+        
+        fillBlock(at(lane, prevIndex), at(refLane, ref), at(lane, index), pass != 0);
+      }
+    }
+  };
+}
+
+void argon2id(
+  const Argon2Cost &cost,
+  const std::experimental::string_view password,
+  const uint8_t *salt,
+  const size_t saltSize,
+  uint8_t *out,
+  const size_t outSize
+) {
+  if (
+    cost.passes == 0 ||
+    cost.lanes == 0 ||
+    cost.lanes > ARGON2_MAX_LANES ||
+    cost.memory < ARGON2_MIN_MEMORY_PER_LANE * cost.lanes
+  ) {
+    throw std::runtime_error("Invalid key derivation parameters");
+  }
+  
+  uint8_t seed[SEED_SIZE];
+  Blake2b hasher(SEED_SIZE);
+  hasher.update32(cost.lanes);
+  hasher.update32(static_cast<uint32_t>(outSize));
+  hasher.update32(cost.memory);
+  hasher.update32(cost.passes);
+  hasher.update32(VERSION);
+  hasher.update32(TYPE_ID);
+  hasher.update32(static_cast<uint32_t>(password.size()));
+  hasher.update(reinterpret_cast<const uint8_t *>(password.data()), password.size());
+  hasher.update32(static_cast<uint32_t>(saltSize));
+  hasher.update(salt, saltSize);
+  //no secret and no associated data
+  hasher.update32(0);
+  hasher.update32(0);
+  hasher.finalize(seed);
+  
+  Instance instance(cost);
+  instance.init(seed);
+  instance.fill();
+  instance.finalize(out, outSize);
+}
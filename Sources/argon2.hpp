@@ -0,0 +1,38 @@
+//
+//  argon2.hpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 15/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#ifndef argon2_hpp
+#define argon2_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include <experimental/string_view>
+
+//The cost of deriving a key. Memory is in KiB. Each lane is filled by its own
+//thread so the lanes are also the number of threads that are used
+struct Argon2Cost {
+  uint32_t memory;
+  uint32_t passes;
+  uint32_t lanes;
+};
+
+constexpr uint32_t ARGON2_MIN_MEMORY_PER_LANE = 8;
+constexpr uint32_t ARGON2_MAX_LANES = 64;
+
+//Argon2id (RFC 9106) of the password and salt. The number of bytes written
+//to the output is the size of the output
+void argon2id(
+  const Argon2Cost &,
+  std::experimental::string_view,
+  const uint8_t *,
+  size_t,
+  uint8_t *,
+  size_t
+);
+
+#endif
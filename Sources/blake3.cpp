@@ -0,0 +1,456 @@
+//
+//  blake3.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 14/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "blake3.hpp"
+
+#include <algorithm>
+
+namespace {
+  constexpr uint32_t IV[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+  };
+  
+  //The message words used by each round. Each row is the previous row
+  //permuted by {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8}
+  constexpr size_t MSG_SCHEDULE[7][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8},
+    {3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1},
+    {10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6},
+    {12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4},
+    {9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7},
+    {11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13}
+  };
+  
+  constexpr uint32_t CHUNK_START = 1 << 0;
+  constexpr uint32_t CHUNK_END = 1 << 1;
+  constexpr uint32_t PARENT = 1 << 2;
+  constexpr uint32_t ROOT = 1 << 3;
+  constexpr uint32_t KEYED_HASH = 1 << 4;
+  
+  constexpr size_t BLOCK_SIZE = 64;
+  
+  uint32_t rotr(const uint32_t x, const int n) {
+    return (x >> n) | (x << (32 - n));
+  }
+  
+  void g(
+    uint32_t *state,
+    const size_t a, const size_t b, const size_t c, const size_t d,
+    const uint32_t x, const uint32_t y
+  ) {
+    state[a] += state[b] + x;
+    state[d] = rotr(state[d] ^ state[a], 16);
+    state[c] += state[d];
+    state[b] = rotr(state[b] ^ state[c], 12);
+    state[a] += state[b] + y;
+    state[d] = rotr(state[d] ^ state[a], 8);
+    state[c] += state[d];
+    state[b] = rotr(state[b] ^ state[c], 7);
+  }
+  
+  void compress(
+    const uint32_t *cv,
+    const uint32_t *blockWords,
+    const uint64_t counter,
+    const uint32_t blockLen,
+    const uint32_t flags,
+    uint32_t *out
+  ) {
+    uint32_t state[16] = {
+      cv[0], cv[1], cv[2], cv[3],
+      cv[4], cv[5], cv[6], cv[7],
+      IV[0], IV[1], IV[2], IV[3],
+      static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32),
+      blockLen, flags
+    };
+    const uint32_t *m = blockWords;
+    
+    for (int r = 0; r != 7; ++r) {
+      const size_t *s = MSG_SCHEDULE[r];
+      g(state, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+      g(state, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+      g(state, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+      g(state, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+      g(state, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+      g(state, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+      g(state, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+      g(state, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+    
+    for (size_t i = 0; i != 8; ++i) {
+      out[i] = state[i] ^ state[i + 8];
+      out[i + 8] = state[i + 8] ^ cv[i];
+    }
+  }
+  
+  void loadWords(const uint8_t *bytes, uint32_t *words, const size_t count) {
+    for (size_t i = 0; i != count; ++i) {
+      words[i] = uint32_t(bytes[i * 4])
+               | uint32_t(bytes[i * 4 + 1]) << 8
+               | uint32_t(bytes[i * 4 + 2]) << 16
+               | uint32_t(bytes[i * 4 + 3]) << 24;
+    }
+  }
+  
+  //The chaining value of a whole chunk that isn't the root
+  Blake3CV wholeChunkCV(
+    const Blake3Key &key,
+    const uint8_t *chunk,
+    const uint64_t counter
+  ) {
+    Blake3CV cv = key;
+    uint32_t words[16];
+    uint32_t out[16];
+    for (size_t b = 0; b != BLAKE3_CHUNK_SIZE / BLOCK_SIZE; ++b) {
+      uint32_t flags = KEYED_HASH;
+      if (b == 0) {
+        flags |= CHUNK_START;
+      }
+      if (b == BLAKE3_CHUNK_SIZE / BLOCK_SIZE - 1) {
+        flags |= CHUNK_END;
+      }
+      loadWords(chunk + b * BLOCK_SIZE, words, 16);
+      compress(cv.data(), words, counter, BLOCK_SIZE, flags, out);
+      std::copy(out, out + 8, cv.begin());
+    }
+    return cv;
+  }
+  
+  Blake3CV parentCV(
+    const Blake3Key &key,
+    const Blake3CV &left,
+    const Blake3CV &right
+  ) {
+    uint32_t words[16];
+    std::copy(left.cbegin(), left.cend(), words);
+    std::copy(right.cbegin(), right.cend(), words + 8);
+    uint32_t out[16];
+    compress(key.data(), words, 0, BLOCK_SIZE, PARENT | KEYED_HASH, out);
+    Blake3CV cv;
+    std::copy(out, out + 8, cv.begin());
+    return cv;
+  }
+}
+
+#ifdef __GNUC__
+
+namespace {
+  template <typename Vec>
+  __attribute__((always_inline)) inline void gLanes(
+    Vec *state,
+    const size_t a, const size_t b, const size_t c, const size_t d,
+    const Vec &x, const Vec &y
+  ) {
+    state[a] += state[b] + x;
+    state[d] ^= state[a];
+    state[d] = (state[d] >> 16) | (state[d] << 16);
+    state[c] += state[d];
+    state[b] ^= state[c];
+    state[b] = (state[b] >> 12) | (state[b] << 20);
+    state[a] += state[b] + y;
+    state[d] ^= state[a];
+    state[d] = (state[d] >> 8) | (state[d] << 24);
+    state[c] += state[d];
+    state[b] ^= state[c];
+    state[b] = (state[b] >> 7) | (state[b] << 25);
+  }
+  
+  //Hashes one whole chunk in each lane of the vector. The chunks are
+  //consecutive so a run of chunks is hashed at the same time.
+  template <typename Vec>
+  __attribute__((always_inline)) inline void chunkLanes(
+    const Blake3Key &key,
+    const uint8_t *chunks,
+    const uint64_t counter,
+    Blake3CV *out
+  ) {
+    constexpr size_t LANES = sizeof(Vec) / sizeof(uint32_t);
+    
+    Vec cv[8];
+    for (size_t i = 0; i != 8; ++i) {
+      cv[i] = Vec{} + key[i];
+    }
+    Vec counterLow, counterHigh;
+    for (size_t l = 0; l != LANES; ++l) {
+      counterLow[l] = static_cast<uint32_t>(counter + l);
+      counterHigh[l] = static_cast<uint32_t>((counter + l) >> 32);
+    }
+    
+    for (size_t b = 0; b != BLAKE3_CHUNK_SIZE / BLOCK_SIZE; ++b) {
+      Vec m[16];
+      for (size_t l = 0; l != LANES; ++l) {
+        uint32_t words[16];
+        loadWords(chunks + l * BLAKE3_CHUNK_SIZE + b * BLOCK_SIZE, words, 16);
+        for (size_t i = 0; i != 16; ++i) {
+          m[i][l] = words[i];
+        }
+      }
+      
+      uint32_t flags = KEYED_HASH;
+      if (b == 0) {
+        flags |= CHUNK_START;
+      }
+      if (b == BLAKE3_CHUNK_SIZE / BLOCK_SIZE - 1) {
+        flags |= CHUNK_END;
+      }
+      
+      Vec state[16] = {
+        cv[0], cv[1], cv[2], cv[3],
+        cv[4], cv[5], cv[6], cv[7],
+        Vec{} + IV[0], Vec{} + IV[1], Vec{} + IV[2], Vec{} + IV[3],
+        counterLow, counterHigh,
+        Vec{} + uint32_t(BLOCK_SIZE), Vec{} + flags
+      };
+      
+      for (int r = 0; r != 7; ++r) {
+        const size_t *s = MSG_SCHEDULE[r];
+        gLanes(state, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+        gLanes(state, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+        gLanes(state, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+        gLanes(state, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+        gLanes(state, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+        gLanes(state, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+        gLanes(state, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+        gLanes(state, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+      }
+      
+      for (size_t i = 0; i != 8; ++i) {
+        cv[i] = state[i] ^ state[i + 8];
+      }
+    }
+    
+    for (size_t l = 0; l != LANES; ++l) {
+      for (size_t i = 0; i != 8; ++i) {
+        out[l][i] = cv[i][l];
+      }
+    }
+  }
+  
+  using Vec4 = uint32_t __attribute__((vector_size(16)));
+  using Vec8 = uint32_t __attribute__((vector_size(32)));
+  
+  size_t chunks4(
+    const Blake3Key &key,
+    const uint8_t *chunks,
+    const uint64_t counter,
+    Blake3CV *out
+  ) {
+    chunkLanes<Vec4>(key, chunks, counter, out);
+    return 4;
+  }
+  
+  #if defined(__x86_64__) || defined(__i386__)
+  __attribute__((target("avx2")))
+  size_t chunks8(
+    const Blake3Key &key,
+    const uint8_t *chunks,
+    const uint64_t counter,
+    Blake3CV *out
+  ) {
+    chunkLanes<Vec8>(key, chunks, counter, out);
+    return 8;
+  }
+  #endif
+  
+  //Hashes a fixed number of chunks and returns that number
+  using LanesFunction = size_t (*)(
+    const Blake3Key &, const uint8_t *, uint64_t, Blake3CV *
+  );
+  
+  struct Lanes {
+    LanesFunction function;
+    size_t count;
+  };
+  
+  Lanes chooseLanes() {
+    #if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return {chunks8, 8};
+    }
+    #endif
+    return {chunks4, 4};
+  }
+  
+  const Lanes lanesKernel = chooseLanes();
+}
+
+#endif
+
+Blake3CV Blake3::Output::chainingValue() const {
+  uint32_t out[16];
+  compress(cv.data(), block, counter, blockLen, flags, out);
+  Blake3CV chaining;
+  std::copy(out, out + 8, chaining.begin());
+  return chaining;
+}
+
+Blake3Hash Blake3::Output::rootBytes() const {
+  uint32_t out[16];
+  compress(cv.data(), block, counter, blockLen, flags | ROOT, out);
+  Blake3Hash hash;
+  for (size_t i = 0; i != 8; ++i) {
+    hash[i * 4 + 0] = static_cast<uint8_t>(out[i]);
+    hash[i * 4 + 1] = static_cast<uint8_t>(out[i] >> 8);
+    hash[i * 4 + 2] = static_cast<uint8_t>(out[i] >> 16);
+    hash[i * 4 + 3] = static_cast<uint8_t>(out[i] >> 24);
+  }
+  return hash;
+}
+
+Blake3::Blake3(const Blake3Key &key, const uint64_t firstChunk)
+  : key(key), stack(), chunkCounter(firstChunk), chunkCV(key), block() {}
+
+void Blake3::update(const char *data, size_t size) {
+  const uint8_t *input = reinterpret_cast<const uint8_t *>(data);
+  
+  while (size != 0) {
+    //a full chunk is only finished when we know that it isn't the last one
+    if (chunkLen() == BLAKE3_CHUNK_SIZE) {
+      addChunkCV(chunkOutput().chainingValue(), chunkCounter + 1);
+      ++chunkCounter;
+      startChunk();
+    }
+    
+    #ifdef __GNUC__
+    //runs of whole chunks are hashed side by side in the lanes of a vector
+    if (chunkLen() == 0 && size > lanesKernel.count * BLAKE3_CHUNK_SIZE) {
+      Blake3CV cvs[8];
+      const size_t count = lanesKernel.function(key, input, chunkCounter, cvs);
+      for (size_t c = 0; c != count; ++c) {
+        addChunkCV(cvs[c], chunkCounter + 1);
+        ++chunkCounter;
+      }
+      input += count * BLAKE3_CHUNK_SIZE;
+      size -= count * BLAKE3_CHUNK_SIZE;
+      continue;
+    }
+    #endif
+    
+    //whole chunks can skip the block buffer
+    if (chunkLen() == 0 && size > BLAKE3_CHUNK_SIZE) {
+      addChunkCV(wholeChunkCV(key, input, chunkCounter), chunkCounter + 1);
+      ++chunkCounter;
+      input += BLAKE3_CHUNK_SIZE;
+      size -= BLAKE3_CHUNK_SIZE;
+      continue;
+    }
+    
+    //likewise, a full block is only compressed when more input arrives
+    if (blockLen == BLOCK_SIZE) {
+      uint32_t words[16];
+      loadWords(block, words, 16);
+      const uint32_t flags = KEYED_HASH | (blocksCompressed == 0 ? CHUNK_START : 0);
+      uint32_t out[16];
+      compress(chunkCV.data(), words, chunkCounter, BLOCK_SIZE, flags, out);
+      std::copy(out, out + 8, chunkCV.begin());
+      ++blocksCompressed;
+      blockLen = 0;
+    }
+    
+    const size_t take = std::min(BLOCK_SIZE - blockLen, size);
+    std::copy(input, input + take, block + blockLen);
+    blockLen += static_cast<uint32_t>(take);
+    input += take;
+    size -= take;
+  }
+}
+
+void Blake3::pushSubtree(const Blake3CV &cv, const uint64_t chunks) {
+  if (chunkLen() == BLAKE3_CHUNK_SIZE) {
+    addChunkCV(chunkOutput().chainingValue(), chunkCounter + 1);
+    ++chunkCounter;
+    startChunk();
+  }
+  
+  //the subtree completes the same subtrees that its last chunk would have
+  uint64_t total = (chunkCounter + chunks) / chunks;
+  Blake3CV newCV = cv;
+  while ((total & 1) == 0) {
+    newCV = parentCV(key, stack.back(), newCV);
+    stack.pop_back();
+    total >>= 1;
+  }
+  stack.push_back(newCV);
+  chunkCounter += chunks;
+  startChunk();
+}
+
+Blake3Hash Blake3::finalize() const {
+  Output output = chunkOutput();
+  for (auto cv = stack.crbegin(); cv != stack.crend(); ++cv) {
+    output = parentOutput(key, *cv, output.chainingValue());
+  }
+  return output.rootBytes();
+}
+
+Blake3CV Blake3::chainingValue() const {
+  Blake3CV cv = chunkOutput().chainingValue();
+  for (auto left = stack.crbegin(); left != stack.crend(); ++left) {
+    cv = parentCV(key, *left, cv);
+  }
+  return cv;
+}
+
+size_t Blake3::chunkLen() const {
+  return BLOCK_SIZE * blocksCompressed + blockLen;
+}
+
+Blake3::Output Blake3::chunkOutput() const {
+  Output output;
+  output.cv = chunkCV;
+  uint8_t padded[BLOCK_SIZE] = {};
+  std::copy(block, block + blockLen, padded);
+  loadWords(padded, output.block, 16);
+  output.counter = chunkCounter;
+  output.blockLen = blockLen;
+  output.flags = KEYED_HASH | CHUNK_END | (blocksCompressed == 0 ? CHUNK_START : 0);
+  return output;
+}
+
+void Blake3::startChunk() {
+  chunkCV = key;
+  blockLen = 0;
+  blocksCompressed = 0;
+}
+
+void Blake3::addChunkCV(Blake3CV newCV, uint64_t totalChunks) {
+  //the number of subtrees this chunk completes is the number of trailing zero
+  //bits in the total number of chunks
+  while ((totalChunks & 1) == 0) {
+    newCV = parentCV(key, stack.back(), newCV);
+    stack.pop_back();
+    totalChunks >>= 1;
+  }
+  stack.push_back(newCV);
+}
+
+Blake3::Output Blake3::parentOutput(
+  const Blake3Key &key,
+  const Blake3CV &left,
+  const Blake3CV &right
+) {
+  Output output;
+  output.cv = key;
+  std::copy(left.cbegin(), left.cend(), output.block);
+  std::copy(right.cbegin(), right.cend(), output.block + 8);
+  output.counter = 0;
+  output.blockLen = BLOCK_SIZE;
+  output.flags = PARENT | KEYED_HASH;
+  return output;
+}
+
+bool equalHashes(const Blake3Hash &a, const Blake3Hash &b) {
+  uint8_t diff = 0;
+  for (size_t i = 0; i != a.size(); ++i) {
+    diff |= a[i] ^ b[i];
+  }
+  return diff == 0;
+}
@@ -0,0 +1,75 @@
+//
+//  blake3.hpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 14/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#ifndef blake3_hpp
+#define blake3_hpp
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+using Blake3Key = std::array<uint32_t, 8>;
+//The chaining value of a chunk or a subtree
+using Blake3CV = std::array<uint32_t, 8>;
+using Blake3Hash = std::array<uint8_t, 32>;
+
+constexpr size_t BLAKE3_CHUNK_SIZE = 1024;
+
+//Incremental BLAKE3 in keyed hash mode. BLAKE3 is a tree of chunks so separate
+//subtrees of the input can be hashed independently and then combined.
+class Blake3 {
+public:
+  //The hasher can start part way through the input to hash a subtree. The
+  //first chunk must be a multiple of the number of chunks in the subtree.
+  explicit Blake3(const Blake3Key &, uint64_t = 0);
+  
+  void update(const char *, size_t);
+  //Adds a subtree of a power of two chunks that was hashed separately. The
+  //hasher must be on a multiple of that many chunks.
+  void pushSubtree(const Blake3CV &, uint64_t);
+  
+  Blake3Hash finalize() const;
+  //The chaining value of a subtree of a power of two chunks that isn't the
+  //whole input
+  Blake3CV chainingValue() const;
+
+private:
+  struct Output {
+    Blake3CV cv;
+    uint32_t block[16];
+    uint64_t counter;
+    uint32_t blockLen;
+    uint32_t flags;
+    
+    Blake3CV chainingValue() const;
+    Blake3Hash rootBytes() const;
+  };
+  
+  Blake3Key key;
+  std::vector<Blake3CV> stack;
+  uint64_t chunkCounter = 0;
+  
+  //the chunk that is currently being hashed
+  Blake3CV chunkCV;
+  uint8_t block[64];
+  uint32_t blockLen = 0;
+  uint32_t blocksCompressed = 0;
+  
+  size_t chunkLen() const;
+  Output chunkOutput() const;
+  void startChunk();
+  void addChunkCV(Blake3CV, uint64_t);
+  
+  static Output parentOutput(const Blake3Key &, const Blake3CV &, const Blake3CV &);
+};
+
+//Compares hashes in constant time
+bool equalHashes(const Blake3Hash &, const Blake3Hash &);
+
+#endif
@@ -0,0 +1,235 @@
+//
+//  chacha20.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 13/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "chacha20.hpp"
+
+#include <algorithm>
+#include "simd.hpp"
+
+namespace {
+  uint32_t rotl(const uint32_t x, const int n) {
+    return (x << n) | (x >> (32 - n));
+  }
+  
+  void quarterRound(uint32_t &a, uint32_t &b, uint32_t &c, uint32_t &d) {
+    a += b; d ^= a; d = rotl(d, 16);
+    c += d; b ^= c; b = rotl(b, 12);
+    a += b; d ^= a; d = rotl(d, 8);
+    c += d; b ^= c; b = rotl(b, 7);
+  }
+  
+  void block(
+    const ChaChaKey &key,
+    const uint64_t nonce,
+    const uint64_t counter,
+    uint8_t *out
+  ) {
+    //"expand 32-byte k"
+    const uint32_t input[16] = {
+      0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+      key[0], key[1], key[2], key[3],
+      key[4], key[5], key[6], key[7],
+      static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32),
+      static_cast<uint32_t>(nonce), static_cast<uint32_t>(nonce >> 32)
+    };
+    
+    uint32_t x[16];
+    std::copy(std::begin(input), std::end(input), x);
+    
+    for (int i = 0; i != 10; ++i) {
+      quarterRound(x[0], x[4], x[8], x[12]);
+      quarterRound(x[1], x[5], x[9], x[13]);
+      quarterRound(x[2], x[6], x[10], x[14]);
+      quarterRound(x[3], x[7], x[11], x[15]);
+      quarterRound(x[0], x[5], x[10], x[15]);
+      quarterRound(x[1], x[6], x[11], x[12]);
+      quarterRound(x[2], x[7], x[8], x[13]);
+      quarterRound(x[3], x[4], x[9], x[14]);
+    }
+    
+    for (int i = 0; i != 16; ++i) {
+      const uint32_t word = x[i] + input[i];
+      out[i * 4 + 0] = static_cast<uint8_t>(word);
+      out[i * 4 + 1] = static_cast<uint8_t>(word >> 8);
+      out[i * 4 + 2] = static_cast<uint8_t>(word >> 16);
+      out[i * 4 + 3] = static_cast<uint8_t>(word >> 24);
+    }
+  }
+}
+
+#ifdef __GNUC__
+
+namespace {
+  //Computes one block in each lane of the vector. The blocks have consecutive
+  //counters so a run of blocks is computed at the same time.
+  template <typename Vec>
+  __attribute__((always_inline)) inline void lanes(
+    const ChaChaKey &key,
+    const uint64_t nonce,
+    const uint64_t counter,
+    uint8_t *out
+  ) {
+    constexpr size_t LANES = sizeof(Vec) / sizeof(uint32_t);
+    
+    const uint32_t words[16] = {
+      0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+      key[0], key[1], key[2], key[3],
+      key[4], key[5], key[6], key[7],
+      0, 0,
+      static_cast<uint32_t>(nonce), static_cast<uint32_t>(nonce >> 32)
+    };
+    
+    Vec input[16];
+    for (int i = 0; i != 16; ++i) {
+      input[i] = Vec{} + words[i];
+    }
+    for (size_t l = 0; l != LANES; ++l) {
+      input[12][l] = static_cast<uint32_t>(counter + l);
+      input[13][l] = static_cast<uint32_t>((counter + l) >> 32);
+    }
+    
+    Vec x[16];
+    for (int i = 0; i != 16; ++i) {
+      x[i] = input[i];
+    }
+    
+    auto quarter = [] (Vec &a, Vec &b, Vec &c, Vec &d) {
+      a += b; d ^= a; d = (d << 16) | (d >> 16);
+      c += d; b ^= c; b = (b << 12) | (b >> 20);
+      a += b; d ^= a; d = (d << 8) | (d >> 24);
+      c += d; b ^= c; b = (b << 7) | (b >> 25);
+    };
+    
+    for (int i = 0; i != 10; ++i) {
+      quarter(x[0], x[4], x[8], x[12]);
+      quarter(x[1], x[5], x[9], x[13]);
+      quarter(x[2], x[6], x[10], x[14]);
+      quarter(x[3], x[7], x[11], x[15]);
+      quarter(x[0], x[5], x[10], x[15]);
+      quarter(x[1], x[6], x[11], x[12]);
+      quarter(x[2], x[7], x[8], x[13]);
+      quarter(x[3], x[4], x[9], x[14]);
+    }
+    
+    for (int i = 0; i != 16; ++i) {
+      x[i] += input[i];
+    }
+    
+    for (size_t l = 0; l != LANES; ++l) {
+      uint8_t *const blockOut = out + l * CHACHA_BLOCK_SIZE;
+      for (int i = 0; i != 16; ++i) {
+        const uint32_t word = x[i][l];
+        blockOut[i * 4 + 0] = static_cast<uint8_t>(word);
+        blockOut[i * 4 + 1] = static_cast<uint8_t>(word >> 8);
+        blockOut[i * 4 + 2] = static_cast<uint8_t>(word >> 16);
+        blockOut[i * 4 + 3] = static_cast<uint8_t>(word >> 24);
+      }
+    }
+  }
+  
+  using Vec4 = uint32_t __attribute__((vector_size(16)));
+  using Vec8 = uint32_t __attribute__((vector_size(32)));
+  
+  //Returns the number of blocks that were computed
+  using LanesFunction = size_t (*)(
+    const ChaChaKey &, uint64_t, uint64_t, uint8_t *, size_t
+  );
+  
+  size_t blocks4(
+    const ChaChaKey &key,
+    const uint64_t nonce,
+    const uint64_t counter,
+    uint8_t *out,
+    const size_t blocks
+  ) {
+    size_t b = 0;
+    for (; b + 4 <= blocks; b += 4) {
+      lanes<Vec4>(key, nonce, counter + b, out + b * CHACHA_BLOCK_SIZE);
+    }
+    return b;
+  }
+  
+  #if defined(__x86_64__) || defined(__i386__)
+  __attribute__((target("avx2")))
+  size_t blocks8(
+    const ChaChaKey &key,
+    const uint64_t nonce,
+    const uint64_t counter,
+    uint8_t *out,
+    const size_t blocks
+  ) {
+    size_t b = 0;
+    for (; b + 8 <= blocks; b += 8) {
+      lanes<Vec8>(key, nonce, counter + b, out + b * CHACHA_BLOCK_SIZE);
+    }
+    return b;
+  }
+  #endif
+  
+  LanesFunction chooseLanes() {
+    #if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return blocks8;
+    }
+    #endif
+    return blocks4;
+  }
+  
+  const LanesFunction lanesKernel = chooseLanes();
+}
+
+#endif
+
+void chacha20Blocks(
+  const ChaChaKey &key,
+  const uint64_t nonce,
+  const uint64_t counter,
+  uint8_t *out,
+  const size_t blocks
+) {
+  size_t b = 0;
+  #ifdef __GNUC__
+  b = lanesKernel(key, nonce, counter, out, blocks);
+  #endif
+  for (; b != blocks; ++b) {
+    block(key, nonce, counter + b, out + b * CHACHA_BLOCK_SIZE);
+  }
+}
+
+void chacha20Xor(
+  const ChaChaKey &key,
+  const uint64_t nonce,
+  const uint64_t offset,
+  char *dst,
+  const char *src,
+  size_t size
+) {
+  //enough keystream for a few pages at a time
+  constexpr size_t BUFFER_BLOCKS = 64;
+  uint8_t keystream[BUFFER_BLOCKS * CHACHA_BLOCK_SIZE];
+  
+  uint64_t counter = offset / CHACHA_BLOCK_SIZE;
+  //offset isn't necessarily on a block boundary
+  size_t skip = offset % CHACHA_BLOCK_SIZE;
+  
+  while (size != 0) {
+    const size_t blocks = std::min(
+      BUFFER_BLOCKS,
+      (skip + size + CHACHA_BLOCK_SIZE - 1) / CHACHA_BLOCK_SIZE
+    );
+    chacha20Blocks(key, nonce, counter, keystream, blocks);
+    const size_t used = std::min(size, blocks * CHACHA_BLOCK_SIZE - skip);
+    xorBytes(dst, src, keystream + skip, used);
+    counter += blocks;
+    skip = 0;
+    dst += used;
+    src += used;
+    size -= used;
+  }
+}
@@ -0,0 +1,36 @@
+//
+//  chacha20.hpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 13/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#ifndef chacha20_hpp
+#define chacha20_hpp
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+//A 256 bit ChaCha20 key
+using ChaChaKey = std::array<uint32_t, 8>;
+
+constexpr size_t CHACHA_BLOCK_SIZE = 64;
+
+//Writes blocks of keystream for the key and nonce starting at the block counter
+void chacha20Blocks(const ChaChaKey &, uint64_t, uint64_t, uint8_t *, size_t);
+
+//XORs the source with the keystream starting at a byte offset. Any part of the
+//keystream can be computed without computing the parts before it so a large
+//buffer can be split between threads.
+void chacha20Xor(
+  const ChaChaKey &,
+  uint64_t,
+  uint64_t,
+  char *,
+  const char *,
+  size_t
+);
+
+#endif
@@ -0,0 +1,37 @@
+//
+//  charset.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 16/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "charset.hpp"
+
+#include <string>
+#include <stdexcept>
+
+CharTable charTable(const std::experimental::string_view name) {
+  if (name == "alnum") {
+    return CHAR_TABLE<AlnumCharset>;
+  } else if (name == "symbols") {
+    return CHAR_TABLE<SymbolsCharset>;
+  } else if (name == "hex") {
+    return CHAR_TABLE<HexCharset>;
+  }
+  
+  //a character that appears twice would be twice as likely
+  bool seen[256] = {};
+  std::string symbols;
+  for (const char c : name) {
+    const unsigned char byte = static_cast<unsigned char>(c);
+    if (byte != 0 && !seen[byte]) {
+      seen[byte] = true;
+      symbols.push_back(c);
+    }
+  }
+  if (symbols.size() < 2) {
+    throw std::runtime_error("A charset needs at least 2 different characters");
+  }
+  return makeCharTable(symbols.data(), symbols.size());
+}
@@ -0,0 +1,54 @@
+//
+//  charset.hpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 16/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#ifndef charset_hpp
+#define charset_hpp
+
+#include <array>
+#include <cstddef>
+#include <experimental/string_view>
+
+//Maps a random byte to a character. Bytes at the top of the range would make
+//some characters more likely than others so they map to 0 and are rejected
+using CharTable = std::array<char, 256>;
+
+constexpr CharTable makeCharTable(const char *symbols, const size_t count) {
+  CharTable table = {};
+  const size_t limit = 256 - 256 % count;
+  for (size_t b = 0; b != limit; ++b) {
+    table[b] = symbols[b % count];
+  }
+  return table;
+}
+
+struct AlnumCharset {
+  static constexpr char SYMBOLS[] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+};
+
+//Quotes, backslashes and spaces are left out so that passwords can be typed
+//as arguments
+struct SymbolsCharset {
+  static constexpr char SYMBOLS[] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+    "!#$%&()*+,-./:;<=>?@[]^_{|}~";
+};
+
+struct HexCharset {
+  static constexpr char SYMBOLS[] = "0123456789abcdef";
+};
+
+template <typename Charset>
+constexpr CharTable CHAR_TABLE = makeCharTable(
+  Charset::SYMBOLS, sizeof(Charset::SYMBOLS) - 1
+);
+
+//alnum, symbols or hex. Anything else is a custom set of characters
+CharTable charTable(std::experimental::string_view);
+
+#endif
@@ -9,10 +9,174 @@
 #include "encrypt.hpp"
 
 #include <random>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "lz4.hpp"
+#include "simd.hpp"
+#include "blake3.hpp"
+#include "chacha20.hpp"
+#include "parallel.hpp"
+#include "word list.hpp"
+#include "secure random.hpp"
+#include "sync file.hpp"
+
+Keystream::Keystream(const uint64_t key)
+  : gen(key) {}
+
+void Keystream::fill(uint8_t *bytes, size_t size) {
+  //bytes left over from the previous word are used first
+  while (size != 0 && remaining != 0) {
+    *bytes++ = static_cast<uint8_t>(word);
+    word >>= 8;
+    --remaining;
+    --size;
+  }
+  
+  //every byte of the word is used. The bytes are taken in little endian order
+  //so that files are the same on every platform
+  while (size >= sizeof(uint64_t)) {
+    const uint64_t next = gen();
+    for (size_t i = 0; i != sizeof(uint64_t); ++i) {
+      bytes[i] = static_cast<uint8_t>(next >> (i * 8));
+    }
+    bytes += sizeof(uint64_t);
+    size -= sizeof(uint64_t);
+  }
+  
+  if (size != 0) {
+    word = gen();
+    remaining = sizeof(uint64_t);
+    fill(bytes, size);
+  }
+}
 
 namespace {
   using File = std::unique_ptr<std::FILE, decltype(&std::fclose)>;
-
+  
+  /*
+  
+  legacy file
+    encrypted data
+    encrypted hash of data
+  
+  file
+    magic
+    version
+    key derivation parameters (version 5 and later)
+    nonce (version 3 and later)
+    encrypted data (version 5 and earlier)
+    encrypted hash of data (version 3 and earlier)
+    MAC of encrypted data (version 4 and 5)
+    encrypted chunks (version 6 and later)
+    encrypted chunk directory (version 6 and later)
+      chunk
+        offset in file
+        size (smaller than decrypted size if compressed in version 7)
+        decrypted size
+        MAC of chunk
+    MAC of chunk directory (version 6 and later)
+    number of chunks (version 6 and later)
+  
+  journal record
+    nonce of file
+    nonce of record
+    index of record
+    size of data
+    encrypted data
+    MAC of the rest of the record
+  
+  */
+  
+  constexpr char MAGIC[] = {'P', 'M', 'A', 'N'};
+  
+  //Files without a header were encrypted with one byte from each
+  //uniform_int_distribution<uint8_t> call
+  constexpr uint8_t VERSION_LEGACY = 1;
+  //Keystream uses every byte from the generator
+  constexpr uint8_t VERSION_BULK_KEYSTREAM = 2;
+  //ChaCha20 in counter mode. Any range of the file can be decrypted on its own
+  constexpr uint8_t VERSION_COUNTER = 3;
+  //Encrypt then MAC with keyed BLAKE3. The MAC is computed in the same pass as
+  //the encryption
+  constexpr uint8_t VERSION_MAC = 4;
+  //The key is derived with Argon2id instead of hashed. The salt and cost are
+  //stored in the header
+  constexpr uint8_t VERSION_KDF = 5;
+  //The body is split into chunks that are authenticated on their own. The
+  //chunk directory at the end says where they are
+  constexpr uint8_t VERSION_CHUNKED = 6;
+  //Chunks are compressed with LZ4 before they're encrypted
+  constexpr uint8_t VERSION_COMPRESSED = 7;
+  
+  constexpr size_t HEADER_SIZE = sizeof(MAGIC) + 1;
+  constexpr size_t PARAMS_SIZE = SALT_SIZE + 3 * sizeof(uint32_t);
+  constexpr size_t NONCE_SIZE = sizeof(uint64_t);
+  constexpr size_t MAC_SIZE = sizeof(Blake3Hash);
+  
+  //The first block of keystream is the MAC key so the encrypted data starts
+  //at the second block
+  constexpr uint64_t BODY_KEYSTREAM_OFFSET = CHACHA_BLOCK_SIZE;
+  
+  //The ciphertext is hashed in pieces this big right after it's encrypted or
+  //right before it's decrypted so that it's still in the cache
+  constexpr size_t FUSED_BLOCK_SIZE = 16 * 1024;
+  
+  //The number of bytes encrypted or decrypted by each task in parallelFor
+  constexpr size_t PARALLEL_RANGE_SIZE = 1024 * 1024;
+  
+  static_assert(
+    PARALLEL_RANGE_SIZE % BLAKE3_CHUNK_SIZE == 0,
+    "Every range must be a whole subtree of the MAC"
+  );
+  
+  //The size of each of the buffers in EncryptedWriter and the size of the
+  //pieces that decryptPieces works on
+  constexpr size_t PIECE_SIZE = 4 * PARALLEL_RANGE_SIZE;
+  
+  static_assert(
+    PIECE_SIZE % CHUNK_SIZE == 0,
+    "Every piece must be whole chunks"
+  );
+  
+  constexpr size_t CHUNKED_BODY_BEGIN = HEADER_SIZE + PARAMS_SIZE + NONCE_SIZE;
+  constexpr size_t DIRECTORY_ENTRY_SIZE = sizeof(uint64_t) + 2 * sizeof(uint32_t) + MAC_SIZE;
+  constexpr size_t TRAILER_SIZE = sizeof(uint64_t);
+  //The directory is authenticated as if it were a chunk with this index
+  constexpr uint64_t DIRECTORY_INDEX = ~uint64_t(0);
+  
+  constexpr size_t RECORD_HEADER_SIZE = 3 * sizeof(uint64_t) + sizeof(uint32_t);
+  
+  uint8_t fileVersion(const Compression compression) {
+    return compression == Compression::lz4
+         ? VERSION_COMPRESSED
+         : VERSION_CHUNKED;
+  }
+  
+  //The keystream that files without a header were encrypted with
+  class LegacyKeystream {
+  public:
+    explicit LegacyKeystream(const uint64_t key)
+      : gen(key), dist() {}
+    
+    void fill(uint8_t *bytes, const size_t size) {
+      for (size_t i = 0; i != size; ++i) {
+        bytes[i] = dist(gen);
+      }
+    }
+  
+  private:
+    std::mt19937_64 gen;
+    std::uniform_int_distribution<uint8_t> dist;
+  };
+  
+  void checkBlockSize(const size_t blockSize) {
+    if (blockSize == 0) {
+      throw std::runtime_error("Block size must be greater than zero");
+    }
+  }
+  
   File openFile(const char *path, const char *options) {
     std::FILE *file = std::fopen(path, options);
     if (file == nullptr) {
@@ -21,101 +185,1525 @@ namespace {
       return {file, &std::fclose};
     }
   }
+  
+  void writeBytes(std::FILE *file, const char *bytes, const size_t size) {
+    if (std::fwrite(bytes, 1, size, file) != size) {
+      throw std::runtime_error("File write error");
+    }
+  }
+  
+  //The key is still 64 bits. The rest of the ChaCha20 key is zero
+  ChaChaKey expandKey(const uint64_t key) {
+    return {{
+      static_cast<uint32_t>(key), static_cast<uint32_t>(key >> 32),
+      0, 0, 0, 0, 0, 0
+    }};
+  }
+  
+  uint64_t randomNonce() {
+    SecureRandom &gen = secureRandom();
+    return (uint64_t(gen.word()) << 32) | gen.word();
+  }
+  
+  void writeNonce(char *bytes, const uint64_t nonce) {
+    for (size_t i = 0; i != NONCE_SIZE; ++i) {
+      bytes[i] = static_cast<char>(nonce >> (i * 8));
+    }
+  }
+  
+  uint64_t readNonce(const char *bytes) {
+    uint64_t nonce = 0;
+    for (size_t i = 0; i != NONCE_SIZE; ++i) {
+      nonce |= uint64_t(uint8_t(bytes[i])) << (i * 8);
+    }
+    return nonce;
+  }
+  
+  void write32(char *bytes, const uint32_t word) {
+    for (size_t i = 0; i != sizeof(uint32_t); ++i) {
+      bytes[i] = static_cast<char>(word >> (i * 8));
+    }
+  }
+  
+  uint32_t read32(const char *bytes) {
+    uint32_t word = 0;
+    for (size_t i = 0; i != sizeof(uint32_t); ++i) {
+      word |= uint32_t(uint8_t(bytes[i])) << (i * 8);
+    }
+    return word;
+  }
+  
+  void write64(char *bytes, const uint64_t word) {
+    for (size_t i = 0; i != sizeof(uint64_t); ++i) {
+      bytes[i] = static_cast<char>(word >> (i * 8));
+    }
+  }
+  
+  uint64_t read64(const char *bytes) {
+    uint64_t word = 0;
+    for (size_t i = 0; i != sizeof(uint64_t); ++i) {
+      word |= uint64_t(uint8_t(bytes[i])) << (i * 8);
+    }
+    return word;
+  }
+  
+  void writeParams(char *bytes, const KeyParams &params) {
+    std::copy(params.salt.cbegin(), params.salt.cend(), bytes);
+    bytes += SALT_SIZE;
+    write32(bytes, params.cost.memory);
+    write32(bytes + sizeof(uint32_t), params.cost.passes);
+    write32(bytes + 2 * sizeof(uint32_t), params.cost.lanes);
+  }
+  
+  KeyParams readParams(const char *bytes) {
+    KeyParams params;
+    std::copy(bytes, bytes + SALT_SIZE, params.salt.begin());
+    bytes += SALT_SIZE;
+    params.cost.memory = read32(bytes);
+    params.cost.passes = read32(bytes + sizeof(uint32_t));
+    params.cost.lanes = read32(bytes + 2 * sizeof(uint32_t));
+    return params;
+  }
+  
+  //Encrypts or decrypts size bytes with every core. The offset is the position
+  //of src in the keystream
+  void counterXor(
+    const ChaChaKey &key,
+    const uint64_t nonce,
+    const uint64_t offset,
+    char *dst,
+    const char *src,
+    const size_t size
+  ) {
+    const size_t ranges = (size + PARALLEL_RANGE_SIZE - 1) / PARALLEL_RANGE_SIZE;
+    parallelFor(ranges, [=, &key] (const size_t r) {
+      const size_t begin = r * PARALLEL_RANGE_SIZE;
+      const size_t rangeSize = std::min(PARALLEL_RANGE_SIZE, size - begin);
+      chacha20Xor(
+        key, nonce, offset + begin, dst + begin, src + begin, rangeSize
+      );
+    });
+  }
+  
+  //Each nonce gets its own MAC key
+  Blake3Key macKey(const ChaChaKey &key, const uint64_t nonce) {
+    uint8_t block[CHACHA_BLOCK_SIZE];
+    chacha20Blocks(key, nonce, 0, block, 1);
+    Blake3Key macKey;
+    for (size_t i = 0; i != macKey.size(); ++i) {
+      macKey[i] = uint32_t(block[i * 4])
+                | uint32_t(block[i * 4 + 1]) << 8
+                | uint32_t(block[i * 4 + 2]) << 16
+                | uint32_t(block[i * 4 + 3]) << 24;
+    }
+    return macKey;
+  }
+  
+  enum class Direction {
+    encrypt,
+    decrypt
+  };
+  
+  //XORs a range of the body and hashes the ciphertext piece by piece
+  void xorAndHash(
+    const ChaChaKey &key,
+    const uint64_t nonce,
+    const size_t offset,
+    char *dst,
+    const char *src,
+    const size_t size,
+    Blake3 &mac,
+    const Direction direction
+  ) {
+    for (size_t done = 0; done != size;) {
+      const size_t piece = std::min(FUSED_BLOCK_SIZE, size - done);
+      const uint64_t keystreamOffset = BODY_KEYSTREAM_OFFSET + offset + done;
+      if (direction == Direction::encrypt) {
+        chacha20Xor(key, nonce, keystreamOffset, dst + done, src + done, piece);
+        mac.update(dst + done, piece);
+      } else {
+        //dst and src might be the same
+        mac.update(src + done, piece);
+        chacha20Xor(key, nonce, keystreamOffset, dst + done, src + done, piece);
+      }
+      done += piece;
+    }
+  }
+  
+  //The index of a chunk is hashed before its ciphertext so that chunks can't
+  //be moved around
+  Blake3 chunkHasher(const Blake3Key &macKey, const uint64_t index) {
+    Blake3 mac(macKey);
+    char indexBytes[sizeof(uint64_t)];
+    write64(indexBytes, index);
+    mac.update(indexBytes, sizeof(indexBytes));
+    return mac;
+  }
+  
+  //Encrypts or decrypts a chunk and returns the MAC of its ciphertext. The
+  //offset is the position of the chunk in the keystream
+  Blake3Hash xorChunk(
+    const ChaChaKey &key,
+    const uint64_t nonce,
+    const Blake3Key &macKey,
+    const uint64_t index,
+    const uint64_t offset,
+    char *dst,
+    const char *src,
+    const size_t size,
+    const Direction direction
+  ) {
+    Blake3 mac = chunkHasher(macKey, index);
+    xorAndHash(key, nonce, offset, dst, src, size, mac, direction);
+    return mac.finalize();
+  }
+  
+  //The version says how the chunks are stored so it's authenticated with the
+  //directory. The rest of the header changes the keys
+  Blake3Hash xorDirectory(
+    const ChaChaKey &key,
+    const uint64_t nonce,
+    const Blake3Key &macKey,
+    const uint8_t version,
+    const uint64_t count,
+    char *dst,
+    const char *src,
+    const size_t size,
+    const Direction direction
+  ) {
+    Blake3 mac = chunkHasher(macKey, DIRECTORY_INDEX);
+    const char versionByte = static_cast<char>(version);
+    mac.update(&versionByte, 1);
+    //the directory is encrypted as if it were the chunk after the last one
+    xorAndHash(key, nonce, count * CHUNK_SIZE, dst, src, size, mac, direction);
+    return mac.finalize();
+  }
+  
+  //Hashes the body with every core. Every range but the last one is a
+  //complete subtree of the MAC so each range is given its own hasher
+  Blake3Hash hashRanges(
+    const Blake3Key &key,
+    const size_t size,
+    const std::function<void (size_t, size_t, Blake3 &)> &hashRange
+  ) {
+    const size_t ranges = (size + PARALLEL_RANGE_SIZE - 1) / PARALLEL_RANGE_SIZE;
+    
+    std::vector<Blake3CV> subtrees(ranges == 0 ? 0 : ranges - 1);
+    parallelFor(subtrees.size(), [&] (const size_t r) {
+      const size_t begin = r * PARALLEL_RANGE_SIZE;
+      Blake3 subtree(key, begin / BLAKE3_CHUNK_SIZE);
+      hashRange(begin, PARALLEL_RANGE_SIZE, subtree);
+      subtrees[r] = subtree.chainingValue();
+    });
+    
+    Blake3 mac(key);
+    for (const Blake3CV &subtree : subtrees) {
+      mac.pushSubtree(subtree, PARALLEL_RANGE_SIZE / BLAKE3_CHUNK_SIZE);
+    }
+    const size_t last = subtrees.size() * PARALLEL_RANGE_SIZE;
+    hashRange(last, size - last, mac);
+    return mac.finalize();
+  }
+  
+  //Encrypts or decrypts the body with every core and returns the MAC of the
+  //ciphertext. Each range is only read from memory once
+  Blake3Hash counterXorMAC(
+    const ChaChaKey &key,
+    const uint64_t nonce,
+    char *dst,
+    const char *src,
+    const size_t size,
+    const Direction direction
+  ) {
+    return hashRanges(
+      macKey(key, nonce),
+      size,
+      [&] (const size_t begin, const size_t rangeSize, Blake3 &mac) {
+        xorAndHash(
+          key, nonce, begin, dst + begin, src + begin, rangeSize,
+          mac, direction
+        );
+      }
+    );
+  }
+  
+  //Encrypts or decrypts a piece of the body in place with every core and adds
+  //it to the MAC. The piece starts at the beginning of a range. Every range is
+  //added to the MAC as a subtree except for the last range of the body
+  void xorPiece(
+    const ChaChaKey &key,
+    const uint64_t nonce,
+    const Blake3Key &macKey,
+    Blake3 &mac,
+    const size_t offset,
+    char *piece,
+    const size_t size,
+    const bool last,
+    const Direction direction
+  ) {
+    const size_t ranges = (size + PARALLEL_RANGE_SIZE - 1) / PARALLEL_RANGE_SIZE;
+    
+    std::vector<Blake3CV> subtrees(last && ranges != 0 ? ranges - 1 : ranges);
+    parallelFor(subtrees.size(), [&] (const size_t r) {
+      const size_t begin = r * PARALLEL_RANGE_SIZE;
+      Blake3 subtree(macKey, (offset + begin) / BLAKE3_CHUNK_SIZE);
+      xorAndHash(
+        key, nonce, offset + begin, piece + begin, piece + begin,
+        PARALLEL_RANGE_SIZE, subtree, direction
+      );
+      subtrees[r] = subtree.chainingValue();
+    });
+    
+    for (const Blake3CV &subtree : subtrees) {
+      mac.pushSubtree(subtree, PARALLEL_RANGE_SIZE / BLAKE3_CHUNK_SIZE);
+    }
+    const size_t rest = subtrees.size() * PARALLEL_RANGE_SIZE;
+    xorAndHash(
+      key, nonce, offset + rest, piece + rest, piece + rest, size - rest,
+      mac, direction
+    );
+  }
+  
+  //Reads the file with stdio when it can't be mapped. Bytes are read into the
+  //decrypted string and then decrypted in place
+  class StdioSource {
+  public:
+    static constexpr bool MAPPED = false;
+    
+    explicit StdioSource(const std::experimental::string_view path)
+      : file(openFile(path.data(), "rb")) {
+      //every read goes straight into the output so the stdio buffer is just
+      //an extra copy
+      std::setvbuf(file.get(), nullptr, _IONBF, 0);
+      std::fseek(file.get(), 0, SEEK_END);
+      fileSize = std::ftell(file.get());
+      std::rewind(file.get());
+    }
+    
+    size_t size() const {
+      return fileSize;
+    }
+    
+    const char *read(char *dst, const size_t offset, const size_t size) {
+      if (offset != position) {
+        std::fseek(file.get(), offset, SEEK_SET);
+      }
+      if (std::fread(dst, 1, size, file.get()) != size) {
+        throw std::runtime_error("File read error");
+      }
+      position = offset + size;
+      return dst;
+    }
+  
+  private:
+    File file;
+    size_t fileSize = 0;
+    size_t position = 0;
+  };
+  
+  //Decrypts straight from the page cache into the decrypted string
+  class MappedSource {
+  public:
+    static constexpr bool MAPPED = true;
+    
+    explicit MappedSource(MappedFile &&file)
+      : file(std::move(file)) {}
+    
+    size_t size() const {
+      return file.size();
+    }
+    
+    const char *read(char *, const size_t offset, size_t) {
+      return file.data() + offset;
+    }
+  
+  private:
+    MappedFile file;
+  };
+  
+  //Decrypts a file that was read before the key was ready
+  class LoadedSource {
+  public:
+    static constexpr bool MAPPED = true;
+    
+    explicit LoadedSource(const EncryptedFile &file)
+      : file(file) {}
+    
+    size_t size() const {
+      return file.size();
+    }
+    
+    const char *read(char *, const size_t offset, size_t) {
+      return file.data() + offset;
+    }
+  
+  private:
+    const EncryptedFile &file;
+  };
+  
+  //Decrypts size bytes starting at offset in the source. Each block is
+  //decrypted while it is still in the cache from being read
+  template <typename Source, typename Stream>
+  std::string readDecrypted(
+    Source &source,
+    const size_t begin,
+    const size_t size,
+    Stream stream,
+    const size_t blockSize
+  ) {
+    std::string str(size, '\0');
+    std::unique_ptr<uint8_t []> keystream = std::make_unique<uint8_t []>(blockSize);
+    
+    for (size_t offset = 0; offset != size;) {
+      const size_t blockUsed = std::min(blockSize, size - offset);
+      char *const block = &str[offset];
+      const char *const src = source.read(block, begin + offset, blockUsed);
+      stream.fill(keystream.get(), blockUsed);
+      xorBytes(block, src, keystream.get(), blockUsed);
+      offset += blockUsed;
+    }
+    
+    return str;
+  }
+  
+  //Reads the whole body at once and then decrypts it with every core
+  template <typename Source>
+  std::string readDecryptedCounter(
+    Source &source,
+    const size_t begin,
+    const size_t size,
+    const ChaChaKey &key,
+    const uint64_t nonce
+  ) {
+    std::string str(size, '\0');
+    const char *const src = source.read(&str[0], begin, size);
+    counterXor(key, nonce, 0, &str[0], src, size);
+    return str;
+  }
+  
+  //The MAC is stored right after the body
+  template <typename Source>
+  Blake3Hash readMAC(Source &source, const size_t bodyEnd) {
+    char macBuf[MAC_SIZE];
+    const char *mac = source.read(macBuf, bodyEnd, MAC_SIZE);
+    Blake3Hash hash;
+    std::copy(mac, mac + MAC_SIZE, hash.begin());
+    return hash;
+  }
+  
+  //Decrypts the body and checks the MAC in one pass
+  template <typename Source>
+  std::experimental::optional<std::string> readDecryptedMAC(
+    Source &source,
+    const size_t begin,
+    const size_t size,
+    const ChaChaKey &key,
+    const uint64_t nonce
+  ) {
+    const Blake3Hash expected = readMAC(source, begin + size);
+    std::string str(size, '\0');
+    const char *const src = source.read(&str[0], begin, size);
+    const Blake3Hash actual = counterXorMAC(
+      key, nonce, &str[0], src, size, Direction::decrypt
+    );
+    
+    if (equalHashes(expected, actual)) {
+      return str;
+    } else {
+      return std::experimental::nullopt;
+    }
+  }
+  
+  //Checks the MAC of the body without decrypting it
+  template <typename Source>
+  bool verifyMAC(
+    Source &source,
+    const size_t begin,
+    const size_t size,
+    const ChaChaKey &key,
+    const uint64_t nonce
+  ) {
+    const Blake3Hash expected = readMAC(source, begin + size);
+    //this is only a copy when the file can't be mapped
+    std::unique_ptr<char []> buf;
+    if (!Source::MAPPED) {
+      buf = std::make_unique<char []>(size);
+    }
+    const char *const body = source.read(buf.get(), begin, size);
+    const Blake3Hash actual = hashRanges(
+      macKey(key, nonce),
+      size,
+      [body] (const size_t rangeBegin, const size_t rangeSize, Blake3 &mac) {
+        mac.update(body + rangeBegin, rangeSize);
+      }
+    );
+    return equalHashes(expected, actual);
+  }
+  
+  std::runtime_error modifiedChunk(const ChunkDirectory &dir, const size_t index) {
+    const size_t begin = index * CHUNK_SIZE;
+    const size_t end = begin + dir.chunks[index].plainSize;
+    return std::runtime_error(
+      "Chunk " + std::to_string(index) + " of the file (bytes "
+      + std::to_string(begin) + " to " + std::to_string(end)
+      + " of the database) has been modified"
+    );
+  }
+  
+  //Returns nullopt if the file doesn't have chunks or if the directory isn't
+  //authentic
+  template <typename Source>
+  std::experimental::optional<ChunkDirectory> readDirectory(
+    Source &source,
+    const Key &key
+  ) {
+    const size_t fileSize = source.size();
+    if (fileSize < CHUNKED_BODY_BEGIN + MAC_SIZE + TRAILER_SIZE) {
+      return std::experimental::nullopt;
+    }
+    char headerBuf[CHUNKED_BODY_BEGIN];
+    const char *header = source.read(headerBuf, 0, CHUNKED_BODY_BEGIN);
+    const uint8_t version = header[sizeof(MAGIC)];
+    if (
+      !std::equal(std::begin(MAGIC), std::end(MAGIC), header) ||
+      (version != VERSION_CHUNKED && version != VERSION_COMPRESSED)
+    ) {
+      return std::experimental::nullopt;
+    }
+    ChunkDirectory dir = {};
+    dir.compression = version == VERSION_COMPRESSED
+                    ? Compression::lz4
+                    : Compression::none;
+    dir.key = key.derived;
+    dir.nonce = readNonce(header + HEADER_SIZE + PARAMS_SIZE);
+    dir.macKey = macKey(dir.key, dir.nonce);
+    
+    char trailerBuf[TRAILER_SIZE];
+    const uint64_t count = read64(
+      source.read(trailerBuf, fileSize - TRAILER_SIZE, TRAILER_SIZE)
+    );
+    const size_t space = fileSize - CHUNKED_BODY_BEGIN - MAC_SIZE - TRAILER_SIZE;
+    if (count > space / DIRECTORY_ENTRY_SIZE) {
+      return std::experimental::nullopt;
+    }
+    const size_t dirSize = count * DIRECTORY_ENTRY_SIZE;
+    const size_t dirBegin = fileSize - TRAILER_SIZE - MAC_SIZE - dirSize;
+    
+    const Blake3Hash expected = readMAC(source, dirBegin + dirSize);
+    std::string entries(dirSize, '\0');
+    const char *src = source.read(&entries[0], dirBegin, dirSize);
+    const Blake3Hash actual = xorDirectory(
+      dir.key, dir.nonce, dir.macKey, version, count,
+      &entries[0], src, dirSize, Direction::decrypt
+    );
+    if (!equalHashes(expected, actual)) {
+      return std::experimental::nullopt;
+    }
+    
+    dir.chunks.resize(count);
+    dir.size = 0;
+    uint64_t offset = CHUNKED_BODY_BEGIN;
+    for (size_t c = 0; c != count; ++c) {
+      const char *entry = entries.data() + c * DIRECTORY_ENTRY_SIZE;
+      ChunkInfo &info = dir.chunks[c];
+      info.offset = read64(entry);
+      info.size = read32(entry + sizeof(uint64_t));
+      info.plainSize = read32(entry + sizeof(uint64_t) + sizeof(uint32_t));
+      entry += sizeof(uint64_t) + 2 * sizeof(uint32_t);
+      std::copy(entry, entry + MAC_SIZE, info.mac.begin());
+      
+      const bool sizeValid = dir.compression == Compression::none
+                           ? info.size == info.plainSize
+                           : info.size <= info.plainSize;
+      //the chunks are in order with nothing between them
+      if (
+        info.offset != offset ||
+        !sizeValid ||
+        info.plainSize > CHUNK_SIZE ||
+        (c != count - 1 && info.plainSize != CHUNK_SIZE)
+      ) {
+        throw std::runtime_error("The chunk directory is invalid");
+      }
+      offset += info.size;
+      dir.size += info.plainSize;
+    }
+    if (offset != dirBegin) {
+      throw std::runtime_error("The chunk directory is invalid");
+    }
+    return dir;
+  }
+  
+  std::runtime_error corruptChunk(const size_t index) {
+    return std::runtime_error(
+      "Chunk " + std::to_string(index) + " of the file couldn't be decompressed"
+    );
+  }
+  
+  enum class ChunkStatus : uint8_t {
+    intact,
+    modified,
+    //authentic but the compressed data is invalid
+    corrupt
+  };
+  
+  //Decrypts a run of chunks into the buffer with every core. Throws if any of
+  //them have been modified
+  template <typename Source>
+  void decryptChunks(
+    Source &source,
+    const ChunkDirectory &dir,
+    const size_t first,
+    const size_t count,
+    char *dst
+  ) {
+    //files that can't be mapped are read into the buffer and decrypted in
+    //place
+    std::vector<const char *> srcs(count);
+    for (size_t c = 0; c != count; ++c) {
+      const ChunkInfo &info = dir.chunks[first + c];
+      srcs[c] = source.read(dst + c * CHUNK_SIZE, info.offset, info.size);
+    }
+    
+    std::vector<ChunkStatus> status(count);
+    parallelFor(count, [&] (const size_t c) {
+      const size_t index = first + c;
+      const ChunkInfo &info = dir.chunks[index];
+      char *const plain = dst + c * CHUNK_SIZE;
+      if (info.size == info.plainSize) {
+        const Blake3Hash mac = xorChunk(
+          dir.key, dir.nonce, dir.macKey, index, index * CHUNK_SIZE,
+          plain, srcs[c], info.size, Direction::decrypt
+        );
+        status[c] = equalHashes(mac, info.mac) ? ChunkStatus::intact
+                                               : ChunkStatus::modified;
+        return;
+      }
+      
+      //a compressed chunk is decrypted on the side and then decompressed into
+      //the buffer
+      std::unique_ptr<char []> packed(new char[info.size]);
+      const Blake3Hash mac = xorChunk(
+        dir.key, dir.nonce, dir.macKey, index, index * CHUNK_SIZE,
+        packed.get(), srcs[c], info.size, Direction::decrypt
+      );
+      if (!equalHashes(mac, info.mac)) {
+        status[c] = ChunkStatus::modified;
+      } else if (!lz4Decompress(plain, info.plainSize, packed.get(), info.size)) {
+        status[c] = ChunkStatus::corrupt;
+      } else {
+        status[c] = ChunkStatus::intact;
+      }
+    });
+    
+    for (size_t c = 0; c != count; ++c) {
+      if (status[c] == ChunkStatus::modified) {
+        throw modifiedChunk(dir, first + c);
+      } else if (status[c] == ChunkStatus::corrupt) {
+        throw corruptChunk(first + c);
+      }
+    }
+  }
+  
+  //Checks the MAC of every chunk with every core without decrypting them
+  template <typename Source>
+  std::vector<size_t> modifiedChunks(
+    Source &source,
+    const ChunkDirectory &dir
+  ) {
+    const size_t count = dir.chunks.size();
+    const size_t end = count == 0
+                     ? CHUNKED_BODY_BEGIN
+                     : dir.chunks.back().offset + dir.chunks.back().size;
+    const size_t size = end - CHUNKED_BODY_BEGIN;
+    //this is only a copy when the file can't be mapped
+    std::unique_ptr<char []> buf;
+    if (!Source::MAPPED) {
+      buf = std::make_unique<char []>(size);
+    }
+    const char *const body = source.read(buf.get(), CHUNKED_BODY_BEGIN, size);
+    
+    std::vector<uint8_t> authentic(count);
+    parallelFor(count, [&] (const size_t c) {
+      const ChunkInfo &info = dir.chunks[c];
+      Blake3 mac = chunkHasher(dir.macKey, c);
+      mac.update(body + (info.offset - CHUNKED_BODY_BEGIN), info.size);
+      authentic[c] = equalHashes(mac.finalize(), info.mac);
+    });
+    
+    std::vector<size_t> modified;
+    for (size_t c = 0; c != count; ++c) {
+      if (!authentic[c]) {
+        modified.push_back(c);
+      }
+    }
+    return modified;
+  }
+  
+  //Removes the hash from the end of the decrypted string and checks it
+  bool removeMAC(std::string &str) {
+    if (str.size() < sizeof(size_t)) {
+      return false;
+    }
+    
+    //possible unaligned read
+    const size_t strHash = *reinterpret_cast<const size_t *>(str.data() + str.size() - sizeof(size_t));
+    str.resize(str.size() - sizeof(size_t));
+    
+    std::hash<std::experimental::string_view> hasher;
+    return hasher(str) == strHash;
+  }
+  
+  //Where the body of a file with a MAC starts and what it was encrypted with
+  struct MACHeader {
+    size_t bodyBegin;
+    ChaChaKey key;
+    uint64_t nonce;
+  };
+  
+  //Returns nullopt if the file is from a version without a MAC
+  template <typename Source>
+  std::experimental::optional<MACHeader> readMACHeader(
+    Source &source,
+    const Key &key
+  ) {
+    const size_t fileSize = source.size();
+    if (fileSize < HEADER_SIZE + NONCE_SIZE + MAC_SIZE) {
+      return std::experimental::nullopt;
+    }
+    char headerBuf[HEADER_SIZE];
+    const char *header = source.read(headerBuf, 0, HEADER_SIZE);
+    if (!std::equal(std::begin(MAGIC), std::end(MAGIC), header)) {
+      return std::experimental::nullopt;
+    }
+    const uint8_t version = header[sizeof(MAGIC)];
+    
+    char nonceBuf[NONCE_SIZE];
+    if (version == VERSION_MAC) {
+      const char *nonce = source.read(nonceBuf, HEADER_SIZE, NONCE_SIZE);
+      return MACHeader{
+        HEADER_SIZE + NONCE_SIZE, expandKey(key.legacy), readNonce(nonce)
+      };
+    }
+    const size_t bodyBegin = HEADER_SIZE + PARAMS_SIZE + NONCE_SIZE;
+    if (version == VERSION_KDF && fileSize >= bodyBegin + MAC_SIZE) {
+      //the parameters don't need to be checked against the key. Different
+      //parameters give a different key so the MAC wouldn't match
+      const char *nonce = source.read(
+        nonceBuf, HEADER_SIZE + PARAMS_SIZE, NONCE_SIZE
+      );
+      return MACHeader{bodyBegin, key.derived, readNonce(nonce)};
+    }
+    return std::experimental::nullopt;
+  }
+  
+  //Whether the file starts with the header of a version with chunks
+  template <typename Source>
+  bool chunkedHeader(Source &source) {
+    if (source.size() < HEADER_SIZE) {
+      return false;
+    }
+    char headerBuf[HEADER_SIZE];
+    const char *header = source.read(headerBuf, 0, HEADER_SIZE);
+    const uint8_t version = header[sizeof(MAGIC)];
+    return std::equal(std::begin(MAGIC), std::end(MAGIC), header) &&
+           (version == VERSION_CHUNKED || version == VERSION_COMPRESSED);
+  }
+  
+  //Returns nullopt if authentication fails
+  template <typename Source>
+  std::experimental::optional<std::string> tryDecrypt(
+    Source &source,
+    const Key &key,
+    const size_t blockSize
+  ) {
+    const size_t fileSize = source.size();
+    if (fileSize < sizeof(size_t)) {
+      throw std::runtime_error("File is too small to be a database");
+    }
+    
+    if (const auto dir = readDirectory(source, key)) {
+      std::string str(dir->size, '\0');
+      decryptChunks(source, *dir, 0, dir->chunks.size(), &str[0]);
+      return str;
+    }
+    //the directory of a file with chunks isn't authentic so the phrase is
+    //wrong (or the file was modified). Decrypting it as a legacy file would
+    //only waste time
+    if (chunkedHeader(source)) {
+      return std::experimental::nullopt;
+    }
+    
+    if (fileSize >= HEADER_SIZE + sizeof(size_t)) {
+      if (const auto mac = readMACHeader(source, key)) {
+        auto body = readDecryptedMAC(
+          source,
+          mac->bodyBegin,
+          fileSize - mac->bodyBegin - MAC_SIZE,
+          mac->key,
+          mac->nonce
+        );
+        if (body) {
+          return body;
+        }
+      }
+      
+      char headerBuf[HEADER_SIZE + NONCE_SIZE];
+      const char *header = source.read(headerBuf, 0, HEADER_SIZE);
+      const bool magic = std::equal(std::begin(MAGIC), std::end(MAGIC), header);
+      const uint8_t version = header[sizeof(MAGIC)];
+      std::experimental::optional<std::string> str;
+      
+      if (magic && version == VERSION_BULK_KEYSTREAM) {
+        str = readDecrypted(
+          source,
+          HEADER_SIZE,
+          fileSize - HEADER_SIZE,
+          Keystream(key.legacy),
+          blockSize
+        );
+      } else if (
+        magic &&
+        version == VERSION_COUNTER &&
+        fileSize >= HEADER_SIZE + NONCE_SIZE + sizeof(size_t)
+      ) {
+        const char *nonce = source.read(headerBuf, HEADER_SIZE, NONCE_SIZE);
+        const size_t bodyBegin = HEADER_SIZE + NONCE_SIZE;
+        str = readDecryptedCounter(
+          source,
+          bodyBegin,
+          fileSize - bodyBegin,
+          expandKey(key.legacy),
+          readNonce(nonce)
+        );
+      }
+      
+      if (str && removeMAC(*str)) {
+        return str;
+      }
+      //the encrypted bytes of a legacy file might happen to look like a
+      //header
+    }
+    
+    std::string str = readDecrypted(
+      source, 0, fileSize, LegacyKeystream(key.legacy), blockSize
+    );
+    if (removeMAC(str)) {
+      return str;
+    } else {
+      return std::experimental::nullopt;
+    }
+  }
+  
+  template <typename Source>
+  std::string decryptSource(
+    Source &source,
+    const Key &key,
+    const size_t blockSize
+  ) {
+    auto str = tryDecrypt(source, key, blockSize);
+    if (!str) {
+      throw std::runtime_error("Decryption authentication failed");
+    }
+    return std::move(*str);
+  }
+  
+  template <typename Source>
+  bool verifySource(
+    Source &source,
+    const Key &key,
+    const size_t blockSize
+  ) {
+    if (const auto dir = readDirectory(source, key)) {
+      return modifiedChunks(source, *dir).empty();
+    }
+    if (const auto mac = readMACHeader(source, key)) {
+      const bool valid = verifyMAC(
+        source,
+        mac->bodyBegin,
+        source.size() - mac->bodyBegin - MAC_SIZE,
+        mac->key,
+        mac->nonce
+      );
+      if (valid) {
+        return true;
+      }
+    }
+    
+    //older versions authenticate the plaintext so they have to be decrypted
+    return bool(tryDecrypt(source, key, blockSize));
+  }
 }
 
 std::string decryptFile(
-  const uint64_t key,
-  const std::experimental::string_view path
+  const Key &key,
+  const std::experimental::string_view path,
+  const size_t blockSize
 ) {
-  File file = openFile(path.data(), "rb");
+  checkBlockSize(blockSize);
+  if (auto mapped = MappedFile::map(path.data())) {
+    MappedSource source(std::move(*mapped));
+    return decryptSource(source, key, blockSize);
+  } else {
+    StdioSource source(path);
+    return decryptSource(source, key, blockSize);
+  }
+}
+
+std::string decryptFile(
+  const Key &key,
+  const EncryptedFile &file,
+  const size_t blockSize
+) {
+  checkBlockSize(blockSize);
+  LoadedSource source(file);
+  return decryptSource(source, key, blockSize);
+}
+
+bool decryptPieces(
+  const Key &key,
+  const EncryptedFile &file,
+  std::string &str,
+  const std::function<void ()> &decrypted
+) {
+  LoadedSource source(file);
+  
+  if (const auto dir = readDirectory(source, key)) {
+    //each chunk is authenticated as soon as it's decrypted
+    str.clear();
+    str.reserve(dir->size);
+    const size_t pieceChunks = PIECE_SIZE / CHUNK_SIZE;
+    for (size_t first = 0; first < dir->chunks.size(); first += pieceChunks) {
+      const size_t count = std::min(pieceChunks, dir->chunks.size() - first);
+      const ChunkInfo &begin = dir->chunks[first];
+      const ChunkInfo &end = dir->chunks[first + count - 1];
+      str.resize((first + count - 1) * CHUNK_SIZE + end.plainSize);
+      decryptChunks(source, *dir, first, count, &str[first * CHUNK_SIZE]);
+      file.release(begin.offset, end.offset + end.size - begin.offset);
+      decrypted();
+    }
+    return true;
+  }
+  
+  const auto header = readMACHeader(source, key);
+  if (!header) {
+    return false;
+  }
+  const size_t begin = header->bodyBegin;
+  const size_t size = file.size() - begin - MAC_SIZE;
+  const Blake3Hash expected = readMAC(source, begin + size);
+  const Blake3Key macKey = ::macKey(header->key, header->nonce);
+  Blake3 mac(macKey);
   
-  std::mt19937_64 gen(key);
-  std::uniform_int_distribution<uint8_t> dist;
+  //the string is never reallocated so the pieces that have been given to the
+  //function don't move
+  str.clear();
+  str.reserve(size);
+  for (size_t offset = 0; offset != size;) {
+    const size_t piece = std::min(PIECE_SIZE, size - offset);
+    //each piece is copied and then decrypted in place while it's still in
+    //the cache
+    str.append(file.data() + begin + offset, piece);
+    xorPiece(
+      header->key, header->nonce, macKey, mac, offset, &str[offset], piece,
+      offset + piece == size, Direction::decrypt
+    );
+    file.release(begin + offset, piece);
+    offset += piece;
+    decrypted();
+  }
   
-  std::string str;
+  return equalHashes(expected, mac.finalize());
+}
+
+bool verifyFile(
+  const Key &key,
+  const std::experimental::string_view path,
+  const size_t blockSize
+) {
+  checkBlockSize(blockSize);
+  if (auto mapped = MappedFile::map(path.data())) {
+    MappedSource source(std::move(*mapped));
+    return verifySource(source, key, blockSize);
+  } else {
+    StdioSource source(path);
+    return verifySource(source, key, blockSize);
+  }
+}
+
+EncryptedFile::EncryptedFile(
+  const std::experimental::string_view path,
+  const MappedFile::Access access
+) : mapped(MappedFile::map(path.data(), access)), contents() {
+  if (mapped) {
+    //only a few pages of a file that is read randomly are needed
+    if (access == MappedFile::Access::sequential) {
+      mapped->load();
+    }
+    return;
+  }
   
+  File file = openFile(path.data(), "rb");
   std::fseek(file.get(), 0, SEEK_END);
-  const size_t fileSize = std::ftell(file.get());
-  str.reserve(fileSize);
+  contents.resize(std::ftell(file.get()));
   std::rewind(file.get());
+  if (std::fread(&contents[0], 1, contents.size(), file.get()) != contents.size()) {
+    throw std::runtime_error("File read error");
+  }
+}
+
+const char *EncryptedFile::data() const {
+  return mapped ? mapped->data() : contents.data();
+}
+
+size_t EncryptedFile::size() const {
+  return mapped ? mapped->size() : contents.size();
+}
+
+void EncryptedFile::release(const size_t offset, const size_t size) const {
+  if (mapped) {
+    mapped->release(offset, size);
+  }
+}
+
+void encryptFile(
+  const Key &key,
+  const std::experimental::string_view path,
+  const std::experimental::string_view str
+) {
+  EncryptedWriter writer(key, path);
+  writer.write(str);
+  writer.finish();
+}
+
+EncryptedWriter::EncryptedWriter(
+  const Key &key,
+  const std::experimental::string_view path,
+  const Compression compression
+) : key(key.derived),
+    nonce(randomNonce()),
+    macKey(::macKey(key.derived, nonce)),
+    directory(),
+    compression(compression),
+    path(path.to_string()),
+    tempPath(path.to_string() + ".tmp"),
+    file(openFile(tempPath.c_str(), "wb")),
+    buffers(),
+    packed(),
+    writing() {
+  //every write is a whole buffer so the stdio buffer is just an extra copy
+  std::setvbuf(file.get(), nullptr, _IONBF, 0);
+  for (std::unique_ptr<char []> &buffer : buffers) {
+    buffer.reset(new char[PIECE_SIZE]);
+  }
+  if (compression == Compression::lz4) {
+    packed.reset(new char[PIECE_SIZE]);
+  }
   
-  int b = std::fgetc(file.get());
-  while (b != EOF) {
-    str.push_back(dist(gen) ^ uint8_t(b));
-    b = std::fgetc(file.get());
+  //the header is authenticated because changing the parameters changes the
+  //key, changing the nonce changes the MAC key and the version is hashed with
+  //the chunk directory
+  char header[HEADER_SIZE + PARAMS_SIZE + NONCE_SIZE];
+  std::copy(std::begin(MAGIC), std::end(MAGIC), header);
+  header[sizeof(MAGIC)] = fileVersion(compression);
+  writeParams(header + HEADER_SIZE, key.params);
+  writeNonce(header + HEADER_SIZE + PARAMS_SIZE, nonce);
+  writeBytes(file.get(), header, sizeof(header));
+}
+
+EncryptedWriter::~EncryptedWriter() {
+  if (writing.valid()) {
+    writing.wait();
+  }
+  //the writer wasn't finished so the file is left as it was
+  if (file) {
+    file.reset();
+    std::remove(tempPath.c_str());
+  }
+}
+
+void EncryptedWriter::write(std::experimental::string_view str) {
+  while (!str.empty()) {
+    const size_t size = std::min(str.size(), PIECE_SIZE - used);
+    std::copy(str.data(), str.data() + size, buffers[current].get() + used);
+    used += size;
+    str.remove_prefix(size);
+    if (used == PIECE_SIZE) {
+      submit();
+    }
+  }
+}
+
+void EncryptedWriter::finish() {
+  if (used != 0) {
+    submit();
+  }
+  if (writing.valid()) {
+    writing.get();
   }
   
-  if (str.size() != fileSize) {
-    throw std::runtime_error("File read error");
+  const size_t count = directory.size();
+  std::string entries(count * DIRECTORY_ENTRY_SIZE, '\0');
+  for (size_t c = 0; c != count; ++c) {
+    char *entry = &entries[c * DIRECTORY_ENTRY_SIZE];
+    const ChunkInfo &info = directory[c];
+    write64(entry, info.offset);
+    write32(entry + sizeof(uint64_t), info.size);
+    write32(entry + sizeof(uint64_t) + sizeof(uint32_t), info.plainSize);
+    entry += sizeof(uint64_t) + 2 * sizeof(uint32_t);
+    std::copy(info.mac.begin(), info.mac.end(), entry);
   }
   
-  //possible unaligned read
-  const size_t strHash = *reinterpret_cast<const size_t *>(str.data() + str.size() - sizeof(size_t));
-  int i = sizeof(size_t);
-  while (i--) str.pop_back();
+  const Blake3Hash hash = xorDirectory(
+    key, nonce, macKey, fileVersion(compression), count,
+    &entries[0], entries.data(), entries.size(), Direction::encrypt
+  );
+  char trailer[TRAILER_SIZE];
+  write64(trailer, count);
+  writeBytes(file.get(), entries.data(), entries.size());
+  writeBytes(file.get(), reinterpret_cast<const char *>(hash.data()), hash.size());
+  writeBytes(file.get(), trailer, TRAILER_SIZE);
+  //the data has to be on the disk before the rename is or a crash could leave
+  //a file that was never written
+  const bool synced = syncFile(file.get());
+  if (std::fclose(file.release()) != 0 || !synced) {
+    std::remove(tempPath.c_str());
+    throw std::runtime_error("File write error");
+  }
+  if (!replaceFile(tempPath.c_str(), path.c_str())) {
+    std::remove(tempPath.c_str());
+    throw std::runtime_error("Failed to replace file \"" + path + "\"");
+  }
+}
+
+void EncryptedWriter::submit() {
+  char *const buffer = buffers[current].get();
+  const size_t plainSize = used;
+  const size_t first = directory.size();
+  const size_t count = (plainSize + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  const uint64_t offset = first == 0
+                        ? CHUNKED_BODY_BEGIN
+                        : directory.back().offset + directory.back().size;
+  directory.resize(first + count);
+  size_t size = plainSize;
   
-  //Confirm MAC
-  std::hash<std::experimental::string_view> hasher;
+  if (compression == Compression::none) {
+    parallelFor(count, [&] (const size_t c) {
+      const size_t begin = c * CHUNK_SIZE;
+      const size_t chunkSize = std::min(CHUNK_SIZE, plainSize - begin);
+      ChunkInfo &info = directory[first + c];
+      info.offset = offset + begin;
+      info.size = info.plainSize = static_cast<uint32_t>(chunkSize);
+      info.mac = xorChunk(
+        key, nonce, macKey, first + c, (first + c) * CHUNK_SIZE,
+        buffer + begin, buffer + begin, chunkSize, Direction::encrypt
+      );
+    });
+  } else {
+    //each chunk is compressed and encrypted into its own slot and then the
+    //slots are moved together in the buffer
+    parallelFor(count, [&] (const size_t c) {
+      const size_t begin = c * CHUNK_SIZE;
+      const size_t chunkPlainSize = std::min(CHUNK_SIZE, plainSize - begin);
+      char *const slot = packed.get() + begin;
+      const char *src = slot;
+      size_t chunkSize = lz4Compress(
+        slot, chunkPlainSize - 1, buffer + begin, chunkPlainSize
+      );
+      if (chunkSize == 0) {
+        src = buffer + begin;
+        chunkSize = chunkPlainSize;
+      }
+      ChunkInfo &info = directory[first + c];
+      info.size = static_cast<uint32_t>(chunkSize);
+      info.plainSize = static_cast<uint32_t>(chunkPlainSize);
+      info.mac = xorChunk(
+        key, nonce, macKey, first + c, (first + c) * CHUNK_SIZE,
+        slot, src, chunkSize, Direction::encrypt
+      );
+    });
+    size = 0;
+    for (size_t c = 0; c != count; ++c) {
+      ChunkInfo &info = directory[first + c];
+      info.offset = offset + size;
+      std::copy_n(packed.get() + c * CHUNK_SIZE, info.size, buffer + size);
+      size += info.size;
+    }
+  }
   
-  if (hasher(str) != strHash) {
-    throw std::runtime_error("Decryption authentication failed");
+  //writes have to be in order and the other buffer is filled next so the
+  //previous write has to be finished
+  if (writing.valid()) {
+    writing.get();
+  }
+  std::FILE *const stream = file.get();
+  writing = std::async(std::launch::async, [stream, buffer, size] {
+    writeBytes(stream, buffer, size);
+  });
+  current = (current + 1) % buffers.size();
+  used = 0;
+}
+
+std::experimental::optional<ChunkReader> ChunkReader::open(
+  const Key &key,
+  const std::experimental::string_view path
+) {
+  EncryptedFile file(path, MappedFile::Access::random);
+  LoadedSource source(file);
+  auto dir = readDirectory(source, key);
+  if (!dir) {
+    return std::experimental::nullopt;
+  }
+  return ChunkReader(std::move(file), std::move(*dir));
+}
+
+ChunkReader::ChunkReader(EncryptedFile &&file, ChunkDirectory &&dir)
+  : file(std::move(file)), dir(std::move(dir)), chunks(), range() {}
+
+size_t ChunkReader::size() const {
+  return dir.size;
+}
+
+const ChunkDirectory &ChunkReader::directory() const {
+  return dir;
+}
+
+size_t ChunkReader::decrypted() const {
+  return chunks.size();
+}
+
+std::experimental::string_view ChunkReader::chunk(const size_t index) {
+  if (index >= dir.chunks.size()) {
+    throw std::runtime_error(
+      "Chunk " + std::to_string(index) + " is past the end of the file"
+    );
+  }
+  const auto found = chunks.find(index);
+  if (found != chunks.end()) {
+    return found->second;
+  }
+  std::string plain(dir.chunks[index].plainSize, '\0');
+  LoadedSource source(file);
+  decryptChunks(source, dir, index, 1, &plain[0]);
+  return chunks.emplace(index, std::move(plain)).first->second;
+}
+
+std::experimental::string_view ChunkReader::read(
+  const size_t offset,
+  const size_t size
+) {
+  if (offset > dir.size || size > dir.size - offset) {
+    throw std::runtime_error("Read past the end of the file");
+  }
+  if (size == 0) {
+    return {};
+  }
+  const size_t first = offset / CHUNK_SIZE;
+  const size_t last = (offset + size - 1) / CHUNK_SIZE;
+  if (first == last) {
+    return chunk(first).substr(offset % CHUNK_SIZE, size);
   }
   
-  return str;
+  range.clear();
+  for (size_t c = first; c <= last; ++c) {
+    const std::experimental::string_view bytes = chunk(c);
+    const size_t begin = c == first ? offset % CHUNK_SIZE : 0;
+    const size_t end = c == last ? (offset + size - 1) % CHUNK_SIZE + 1 : bytes.size();
+    range.append(bytes.data() + begin, end - begin);
+  }
+  return range;
 }
 
-void encryptFile(
-  const uint64_t key,
-  const std::experimental::string_view path,
-  const std::experimental::string_view str
+std::vector<size_t> ChunkReader::modifiedChunks() const {
+  LoadedSource source(file);
+  return ::modifiedChunks(source, dir);
+}
+
+uint64_t EncryptedWriter::fileNonce() const {
+  return nonce;
+}
+
+namespace {
+  //Each record has its own nonce so the keystream is never reused. The MAC
+  //covers the header so a record can't be moved to another file or index
+  Blake3Hash xorRecord(
+    const ChaChaKey &key,
+    const char *header,
+    char *dst,
+    const char *src,
+    const size_t size,
+    const Direction direction
+  ) {
+    const uint64_t recordNonce = readNonce(header + sizeof(uint64_t));
+    Blake3 mac(macKey(key, recordNonce));
+    mac.update(header, RECORD_HEADER_SIZE);
+    xorAndHash(key, recordNonce, 0, dst, src, size, mac, direction);
+    return mac.finalize();
+  }
+}
+
+std::string sealRecord(
+  const Key &key,
+  const uint64_t fileNonce,
+  const uint64_t index,
+  const std::experimental::string_view data
+) {
+  std::string record(RECORD_HEADER_SIZE + data.size() + MAC_SIZE, '\0');
+  writeNonce(&record[0], fileNonce);
+  writeNonce(&record[sizeof(uint64_t)], randomNonce());
+  write64(&record[2 * sizeof(uint64_t)], index);
+  write32(&record[3 * sizeof(uint64_t)], static_cast<uint32_t>(data.size()));
+  const Blake3Hash mac = xorRecord(
+    key.derived, record.data(), &record[RECORD_HEADER_SIZE],
+    data.data(), data.size(), Direction::encrypt
+  );
+  std::copy(mac.begin(), mac.end(), &record[RECORD_HEADER_SIZE + data.size()]);
+  return record;
+}
+
+JournalRecords openRecords(
+  const Key &key,
+  const uint64_t fileNonce,
+  const std::experimental::string_view journal
+) {
+  JournalRecords opened = {};
+  size_t pos = 0;
+  while (pos != journal.size()) {
+    const size_t left = journal.size() - pos;
+    const char *header = journal.data() + pos;
+    //an append that was cut off
+    if (
+      left < RECORD_HEADER_SIZE + MAC_SIZE ||
+      left - RECORD_HEADER_SIZE - MAC_SIZE < read32(header + 3 * sizeof(uint64_t))
+    ) {
+      opened.stale = true;
+      break;
+    }
+    const size_t size = read32(header + 3 * sizeof(uint64_t));
+    pos += RECORD_HEADER_SIZE + size + MAC_SIZE;
+    if (readNonce(header) != fileNonce) {
+      opened.stale = true;
+      continue;
+    }
+    
+    std::string data(size, '\0');
+    const Blake3Hash actual = xorRecord(
+      key.derived, header, &data[0], header + RECORD_HEADER_SIZE,
+      size, Direction::decrypt
+    );
+    Blake3Hash expected;
+    std::copy_n(header + RECORD_HEADER_SIZE + size, MAC_SIZE, expected.begin());
+    if (
+      !equalHashes(expected, actual) ||
+      read64(header + 2 * sizeof(uint64_t)) != opened.records.size()
+    ) {
+      throw std::runtime_error("The journal has been modified");
+    }
+    opened.records.push_back(std::move(data));
+  }
+  return opened;
+}
+
+std::experimental::optional<uint64_t> readFileNonce(
+  const std::experimental::string_view path
 ) {
-  File file = openFile(path.data(), "wb");
+  std::FILE *file = std::fopen(path.data(), "rb");
+  if (file == nullptr) {
+    return std::experimental::nullopt;
+  }
+  File stream(file, &std::fclose);
   
-  std::mt19937_64 gen(key);
-  std::uniform_int_distribution<uint8_t> dist;
+  char header[CHUNKED_BODY_BEGIN];
+  if (
+    std::fread(header, 1, sizeof(header), stream.get()) != sizeof(header) ||
+    !std::equal(std::begin(MAGIC), std::end(MAGIC), header)
+  ) {
+    return std::experimental::nullopt;
+  }
+  const uint8_t version = header[sizeof(MAGIC)];
+  if (version != VERSION_CHUNKED && version != VERSION_COMPRESSED) {
+    return std::experimental::nullopt;
+  }
+  return readNonce(header + HEADER_SIZE + PARAMS_SIZE);
+}
+
+namespace {
+  //A file could claim to need any amount of memory
+  constexpr uint32_t MAX_KEY_MEMORY = 1024 * 1024;
+  constexpr uint32_t MAX_KEY_PASSES = 64;
   
-  for (const char c : str) {
-    std::fputc(dist(gen) ^ c, file.get());
+  bool validCost(const Argon2Cost &cost) {
+    return cost.passes != 0 &&
+           cost.passes <= MAX_KEY_PASSES &&
+           cost.lanes != 0 &&
+           cost.lanes <= ARGON2_MAX_LANES &&
+           cost.memory >= ARGON2_MIN_MEMORY_PER_LANE * cost.lanes &&
+           cost.memory <= MAX_KEY_MEMORY;
+  }
+}
+
+KeyParams readKeyParams(const std::experimental::string_view path) {
+  std::FILE *file = std::fopen(path.data(), "rb");
+  if (file == nullptr) {
+    return newKeyParams();
   }
+  File stream(file, &std::fclose);
   
-  //MAC - authenticate then encrypt is secure when used with a stream cipher
-  std::hash<std::experimental::string_view> hasher;
-  const size_t hash = hasher(str);
-  const uint8_t *hashBytes = reinterpret_cast<const uint8_t *>(&hash);
-  const uint8_t *const hashBytesEnd = hashBytes + sizeof(size_t);
+  char header[HEADER_SIZE + PARAMS_SIZE];
+  if (
+    std::fread(header, 1, sizeof(header), stream.get()) != sizeof(header) ||
+    !std::equal(std::begin(MAGIC), std::end(MAGIC), header)
+  ) {
+    return newKeyParams();
+  }
+  const uint8_t version = header[sizeof(MAGIC)];
+  if (
+    version != VERSION_KDF &&
+    version != VERSION_CHUNKED &&
+    version != VERSION_COMPRESSED
+  ) {
+    return newKeyParams();
+  }
   
-  while (hashBytes != hashBytesEnd) {
-    std::fputc(dist(gen) ^ *hashBytes, file.get());
-    ++hashBytes;
+  const KeyParams params = readParams(header + HEADER_SIZE);
+  //a legacy file might happen to look like a header
+  if (validCost(params.cost)) {
+    return params;
+  } else {
+    return newKeyParams();
   }
 }
 
-uint64_t generateKey(const std::experimental::string_view phrase) {
-  const std::hash<std::experimental::string_view> hasher;
-  return hasher(phrase);
+std::experimental::optional<Compression> readCompression(
+  const std::experimental::string_view path
+) {
+  std::FILE *file = std::fopen(path.data(), "rb");
+  if (file == nullptr) {
+    return std::experimental::nullopt;
+  }
+  File stream(file, &std::fclose);
+  
+  char header[HEADER_SIZE];
+  if (
+    std::fread(header, 1, sizeof(header), stream.get()) != sizeof(header) ||
+    !std::equal(std::begin(MAGIC), std::end(MAGIC), header)
+  ) {
+    return std::experimental::nullopt;
+  }
+  const uint8_t version = header[sizeof(MAGIC)];
+  if (version == VERSION_CHUNKED) {
+    return Compression::none;
+  } else if (version == VERSION_COMPRESSED) {
+    return Compression::lz4;
+  } else {
+    return std::experimental::nullopt;
+  }
 }
 
-namespace {
-  constexpr char NUM_CHARS = 10;
-  constexpr char ALPHA_CHARS = 26;
+KeyParams newKeyParams(const Argon2Cost &cost) {
+  KeyParams params;
+  secureRandom().fill(params.salt.data(), SALT_SIZE);
+  params.cost = cost;
+  return params;
+}
+
+KeyParams calibrateKeyParams(
+  const std::chrono::milliseconds target,
+  const uint32_t lanes
+) {
+  if (lanes == 0 || lanes > ARGON2_MAX_LANES) {
+    throw std::runtime_error(
+      "Number of threads must be between 1 and "
+      + std::to_string(ARGON2_MAX_LANES)
+    );
+  }
+  
+  KeyParams params = newKeyParams();
+  Argon2Cost &cost = params.cost;
+  const uint32_t minMemory = ARGON2_MIN_MEMORY_PER_LANE * lanes;
+  cost.lanes = lanes;
+  cost.memory = std::max<uint32_t>(1024, minMemory);
   
-  char mapChar(const char c) {
-    if (c < NUM_CHARS) {
-      return '0' + c;
-    } else if (c < NUM_CHARS + ALPHA_CHARS) {
-      return 'A' + (c - NUM_CHARS);
-    } else { // c < NUM_CHARS + 2 * ALPHA_CHARS
-      return 'a' + (c - NUM_CHARS - ALPHA_CHARS);
+  std::chrono::duration<double> elapsed;
+  uint8_t out[sizeof(ChaChaKey)];
+  //short runs are mostly noise so the memory is doubled until the run is a
+  //quarter of the target
+  while (true) {
+    const auto start = std::chrono::steady_clock::now();
+    argon2id(cost, "calibrate", params.salt.data(), SALT_SIZE, out, sizeof(out));
+    elapsed = std::chrono::steady_clock::now() - start;
+    if (elapsed * 4 >= target || cost.memory > MAX_KEY_MEMORY / 2) {
+      break;
     }
+    cost.memory *= 2;
   }
+  
+  //the time is proportional to the memory times the passes. Memory is
+  //preferred because it's what makes the key expensive to guess
+  double memory = cost.memory * (target / elapsed);
+  if (memory > MAX_KEY_MEMORY) {
+    double passes = cost.passes * memory / MAX_KEY_MEMORY;
+    cost.passes = static_cast<uint32_t>(std::min<double>(passes, MAX_KEY_PASSES));
+    memory = MAX_KEY_MEMORY;
+  }
+  cost.memory = std::max(minMemory, static_cast<uint32_t>(memory));
+  return params;
 }
 
-std::string generatePassword(const size_t size) {
-  static std::random_device gen;
-  std::uniform_int_distribution<char> dist(0, NUM_CHARS + 2 * ALPHA_CHARS);
-  std::string password;
-  while (password.size() < size) {
-    password.push_back(mapChar(dist(gen)));
+Key generateKey(
+  const std::experimental::string_view phrase,
+  const KeyParams &params
+) {
+  Key key;
+  key.params = params;
+  
+  uint8_t bytes[sizeof(ChaChaKey)];
+  argon2id(
+    params.cost, phrase, params.salt.data(), SALT_SIZE, bytes, sizeof(bytes)
+  );
+  for (size_t i = 0; i != key.derived.size(); ++i) {
+    key.derived[i] = read32(reinterpret_cast<const char *>(bytes + i * 4));
   }
+  
+  const std::hash<std::experimental::string_view> hasher;
+  key.legacy = hasher(phrase);
+  return key;
+}
+
+std::string generatePassword(const size_t size, const CharTable &table) {
+  std::string password(size, '\0');
+  generatePassword(&password[0], size, table);
   return password;
-}
\ No newline at end of file
+}
+
+void generatePassword(char *password, size_t size, const CharTable &table) {
+  SecureRandom &gen = secureRandom();
+  uint8_t bytes[4096];
+  while (size != 0) {
+    const size_t batch = std::min(sizeof(bytes), size);
+    gen.fill(bytes, batch);
+    for (size_t i = 0; i != batch; ++i) {
+      //rejected bytes are written and then overwritten by the next byte
+      const char c = table[bytes[i]];
+      *password = c;
+      password += c != 0;
+      size -= c != 0;
+    }
+  }
+}
+
+std::string generatePhrase(const WordList &words, const size_t count) {
+  if (words.size() < 2) {
+    throw std::runtime_error("The word list needs at least 2 words");
+  }
+  
+  SecureRandom &gen = secureRandom();
+  std::string phrase;
+  for (size_t i = 0; i != count; ++i) {
+    if (i != 0) {
+      phrase.push_back('-');
+    }
+    const auto word = words[gen.below(static_cast<uint32_t>(words.size()))];
+    phrase.append(word.data(), word.size());
+  }
+  return phrase;
+}
@@ -9,17 +9,292 @@
 #ifndef encrypt_hpp
 #define encrypt_hpp
 
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <random>
 #include <string>
+#include <vector>
+#include "argon2.hpp"
+#include "blake3.hpp"
+#include "charset.hpp"
+#include "chacha20.hpp"
+#include "mapped file.hpp"
+#include <experimental/optional>
 #include <experimental/string_view>
 
-std::string decryptFile(uint64_t, std::experimental::string_view);
+//Generates the keystream that is XORed with the database. Whole blocks are
+//generated at a time and every byte of the generator's output is used.
+class Keystream {
+public:
+  explicit Keystream(uint64_t);
+  
+  void fill(uint8_t *, size_t);
+
+private:
+  std::mt19937_64 gen;
+  uint64_t word = 0;
+  size_t remaining = 0;
+};
+
+//The number of bytes that are read and decrypted at a time in older files
+constexpr size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+constexpr size_t SALT_SIZE = 16;
+
+//The parameters that a key is derived with. They are stored in the header of
+//the file so the file can be opened with the same parameters
+struct KeyParams {
+  std::array<uint8_t, SALT_SIZE> salt;
+  Argon2Cost cost;
+};
+
+//The cost used for new files. 64 MiB, 3 passes and 4 lanes
+constexpr Argon2Cost DEFAULT_KEY_COST = {64 * 1024, 3, 4};
+
+struct Key {
+  KeyParams params;
+  //derived from the phrase with Argon2id
+  ChaChaKey derived;
+  //older versions of the file were encrypted with a hash of the phrase
+  uint64_t legacy;
+};
+
+//The whole contents of an encrypted file. Reading doesn't need the key so a
+//file can be read on another thread while the key is being derived. Files
+//that are read sequentially are read into memory up front
+class EncryptedFile {
+public:
+  explicit EncryptedFile(
+    std::experimental::string_view,
+    MappedFile::Access = MappedFile::Access::sequential
+  );
+  
+  const char *data() const;
+  size_t size() const;
+  //Drops a range of the file from memory once it has been decrypted. Nothing
+  //is dropped if the file couldn't be mapped
+  void release(size_t, size_t) const;
+
+private:
+  std::experimental::optional<MappedFile> mapped;
+  std::string contents;
+};
+
+std::string decryptFile(
+  const Key &,
+  std::experimental::string_view,
+  size_t = DEFAULT_BLOCK_SIZE
+);
+std::string decryptFile(
+  const Key &,
+  const EncryptedFile &,
+  size_t = DEFAULT_BLOCK_SIZE
+);
+//Decrypts a file with a MAC or chunks a piece at a time. Room for the whole
+//body is reserved in the string and each piece is appended to it before the
+//function is called. Each piece of the encrypted file is dropped from memory
+//once it's decrypted. The MAC of a file without chunks is only checked at the
+//end so the pieces can't be trusted until this returns true. Returns false if
+//the file is from a version without a MAC or if authentication fails. Throws
+//if a chunk has been modified
+bool decryptPieces(
+  const Key &,
+  const EncryptedFile &,
+  std::string &,
+  const std::function<void ()> &
+);
+//Checks that the file was encrypted with the key and hasn't been modified.
+//The newest version of the file is checked without decrypting it
+bool verifyFile(
+  const Key &,
+  std::experimental::string_view,
+  size_t = DEFAULT_BLOCK_SIZE
+);
 void encryptFile(
-  uint64_t,
+  const Key &,
   std::experimental::string_view,
   std::experimental::string_view
 );
 
-uint64_t generateKey(std::experimental::string_view);
-std::string generatePassword(size_t);
+//New files are split into chunks of this many bytes. Each chunk is encrypted
+//and authenticated on its own so that it can be read without the rest of the
+//file
+constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+//Whether the chunks of a file are compressed before they're encrypted. The
+//version in the header of the file says which
+enum class Compression {
+  none,
+  //Each chunk is compressed on its own so that it can still be read without
+  //the rest of the file. Chunks that don't get smaller are stored as they are
+  lz4
+};
+
+//Where a chunk is in the file and the MAC of its ciphertext
+struct ChunkInfo {
+  uint64_t offset;
+  //a compressed chunk is smaller than its decrypted size
+  uint32_t size;
+  //every chunk but the last one has CHUNK_SIZE decrypted bytes
+  uint32_t plainSize;
+  Blake3Hash mac;
+};
+
+//The decrypted chunk directory of a file and the keys of its chunks
+struct ChunkDirectory {
+  ChaChaKey key;
+  uint64_t nonce;
+  Blake3Key macKey;
+  std::vector<ChunkInfo> chunks;
+  //the size of the decrypted file
+  size_t size;
+  Compression compression;
+};
+
+//Encrypts a file as it's written so that only two buffers of the plaintext
+//are in memory at once. The chunks of one buffer are encrypted with every
+//core and written to disk on another thread while the other is filled.
+//Everything goes to a temporary file that replaces the file when it's
+//finished so the file is never left half written. The temporary file is on
+//the disk before it replaces the file so a crash leaves either the old file or
+//the new one
+class EncryptedWriter {
+public:
+  EncryptedWriter(
+    const Key &,
+    std::experimental::string_view,
+    Compression = Compression::none
+  );
+  EncryptedWriter(const EncryptedWriter &) = delete;
+  ~EncryptedWriter();
+  
+  EncryptedWriter &operator=(const EncryptedWriter &) = delete;
+  
+  void write(std::experimental::string_view);
+  //Writes the chunk directory and replaces the file. If this isn't called
+  //then the file isn't changed
+  void finish();
+  //The nonce in the header of the new file. Journal records are tied to the
+  //file with it
+  uint64_t fileNonce() const;
+
+private:
+  ChaChaKey key;
+  uint64_t nonce;
+  //every chunk is hashed by its own hasher with this key
+  Blake3Key macKey;
+  std::vector<ChunkInfo> directory;
+  Compression compression;
+  std::string path;
+  std::string tempPath;
+  std::unique_ptr<std::FILE, decltype(&std::fclose)> file;
+  std::array<std::unique_ptr<char []>, 2> buffers;
+  //the compressed chunks of a buffer are encrypted here before they're
+  //moved together
+  std::unique_ptr<char []> packed;
+  size_t current = 0;
+  size_t used = 0;
+  std::future<void> writing;
+  
+  void submit();
+};
+
+//Reads a file with chunks without decrypting all of it. The chunk directory
+//is decrypted and authenticated when the file is opened. Each chunk is
+//decrypted and authenticated when it's first read
+class ChunkReader {
+public:
+  //Returns nullopt if the file doesn't have chunks or if the directory isn't
+  //authentic (the key might be wrong)
+  static std::experimental::optional<ChunkReader> open(
+    const Key &,
+    std::experimental::string_view
+  );
+  
+  //The size of the decrypted file
+  size_t size() const;
+  const ChunkDirectory &directory() const;
+  //The number of chunks that have been decrypted
+  size_t decrypted() const;
+  
+  //Throws if the chunk has been modified
+  std::experimental::string_view chunk(size_t);
+  //Decrypts the chunks that hold the range of the decrypted file. The range
+  //only lasts until the next read. Throws if a chunk has been modified
+  std::experimental::string_view read(size_t, size_t);
+  //Checks every chunk without decrypting them
+  std::vector<size_t> modifiedChunks() const;
+
+private:
+  ChunkReader(EncryptedFile &&, ChunkDirectory &&);
+  
+  EncryptedFile file;
+  ChunkDirectory dir;
+  std::map<size_t, std::string> chunks;
+  //a range that spans chunks is copied here
+  std::string range;
+};
+
+//Records of a journal are appended to a file next to the database. Each one
+//is encrypted and authenticated on its own and is tied to a database file by
+//the nonce of the file. The index of a record is authenticated so records
+//can't be reordered
+std::string sealRecord(
+  const Key &,
+  uint64_t,
+  uint64_t,
+  std::experimental::string_view
+);
+
+struct JournalRecords {
+  std::vector<std::string> records;
+  //the journal has records for other files or a record that was cut off
+  bool stale;
+};
+
+//Decrypts the records of a journal that are tied to the file with the nonce.
+//Records for other files are skipped. A record at the end that was cut off is
+//ignored because the append was interrupted. Throws if a record of the file
+//has been modified. Records can be removed from the end of a journal without
+//it being noticed
+JournalRecords openRecords(
+  const Key &,
+  uint64_t,
+  std::experimental::string_view
+);
+
+//The nonce in the header of the file. Returns nullopt for files from versions
+//without chunks (or files that don't exist)
+std::experimental::optional<uint64_t> readFileNonce(
+  std::experimental::string_view
+);
+
+//The parameters in the header of the file. Files from older versions (or
+//files that don't exist) get the default cost and a new salt
+KeyParams readKeyParams(std::experimental::string_view);
+//The compression in the header of the file. Returns nullopt for files from
+//versions without chunks (or files that don't exist)
+std::experimental::optional<Compression> readCompression(
+  std::experimental::string_view
+);
+//A new salt for the cost
+KeyParams newKeyParams(const Argon2Cost & = DEFAULT_KEY_COST);
+//Doubles the memory until deriving a key takes a good fraction of the target
+//time and then scales it to fit. The number of lanes is kept
+KeyParams calibrateKeyParams(std::chrono::milliseconds, uint32_t);
+
+Key generateKey(std::experimental::string_view, const KeyParams &);
+std::string generatePassword(size_t, const CharTable & = CHAR_TABLE<AlnumCharset>);
+//Fills the buffer with random characters from the table
+void generatePassword(char *, size_t, const CharTable & = CHAR_TABLE<AlnumCharset>);
+
+class WordList;
+//Random words from the list separated by dashes
+std::string generatePhrase(const WordList &, size_t);
 
 #endif
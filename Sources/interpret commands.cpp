@@ -8,7 +8,11 @@
 
 #include "interpret commands.hpp"
 
+#include <chrono>
+#include <future>
 #include <fstream>
+#include <cmath>
+#include <limits>
 #include <iostream>
 #include "encrypt.hpp"
 #include "write to clipboard.hpp"
@@ -22,6 +26,17 @@ open <phrase> <file>
   Opens a file and decrypts it. Once opened, the file can be manipulated. If the
   file either doesn't exist or is empty, then a new database is created.
 
+verify <phrase> <file>
+  Checks that a file was encrypted with the phrase and hasn't been modified
+  since. The passwords are not loaded. The chunks of the file that have been
+  modified are listed. The changes in the journal are checked too.
+
+lookup <phrase> <file> <name>
+  Prints a password from a file without opening it. Only the chunks of the file
+  that hold the index and the entry are decrypted. Changes in the journal
+  that haven't been written to the file yet are taken into account. The file
+  must have been written in the indexed layout.
+
 close
   Flushes the current changes and closes the database. The open command must
   be used to open a new database.
@@ -29,17 +44,55 @@ close
 change_phrase <old_phrase> <new_phrase>
   Changes the encryption phrase for the database.
 
+calibrate <phrase> <milliseconds> <threads>
+  Chooses how much memory the key derivation uses so that opening the database
+  takes about that many milliseconds on this machine. The key is derived with
+  that many threads. The new parameters are saved in the file when it is
+  flushed.
+
+convert_indexed
+  The database is written in the indexed layout when it is flushed. Each name
+  and password is stored with its length so passwords can be empty. The file
+  ends with an index that a single password can be looked up in. New databases
+  use this layout.
+
+convert_legacy
+  The database is written in the layout of older versions when it is flushed.
+  Names and passwords can't be empty in this layout.
+
+compress
+  The database is compressed with LZ4 before it is encrypted when it is
+  flushed. Each chunk is compressed on its own so lookup still works. The size
+  of the file says a little about how repetitive the names and passwords are.
+
+decompress
+  The database is encrypted without compressing it when it is flushed. New
+  databases aren't compressed.
+
 clear
   Removes every entry from the database.
 
 flush
-  Writes all changes to the file (if it exists).
+  Writes all changes to the file (if it exists) and waits until they are on
+  the disk. Nothing is written if the database hasn't changed since it was
+  opened or last flushed, unless the file is from an older version.
+  Creating, changing, renaming and removing a password appends the change to
+  "<file>.journal" instead so the file isn't rewritten. The journal is replayed
+  when the database is opened and is compacted into the file in the background
+  once it gets large. Other changes are written in the background after every
+  command. The file is replaced in a single step so a crash never leaves it
+  half written.
+
+status
+  Prints whether the database has changed since it was last flushed, the
+  number of changes in the journal and the number of passwords in it.
 
 quit
   Writes all changes to the file (if it exists) and exits.
 
 quit_no_flush
-  Exits without flushing changes.
+  Exits without flushing changes. Changes that have already been written to
+  the journal or the file are kept.
 
 dump <file>
   Writes all passwords into a file WITHOUT ENCRYPTING them. This command is
@@ -58,19 +111,32 @@ list
 count
   Prints the number of passwords in the database.
 
-gen <length>
-  Prints a randomly generated string
+gen <length> [charset]
+  Prints a randomly generated string. The charset is alnum (the default),
+  symbols (alnum and punctuation), hex or the characters to choose from.
+
+gen_many <count> <length> [charset]
+  Prints that many randomly generated strings. One on each line.
+
+gen_phrase <words>
+  Prints a phrase of that many random words separated by dashes. The words
+  are taken from "words.txt" next to the executable. The file has one word on
+  each line.
 
 create <name> <password>
   Creates a new entry in the database.
 
-create_gen <name> <length>
+create_gen <name> <length> [charset]
   Generates a password and puts it into the database.
 
-create_gen_copy <name> <length>
+create_gen_copy <name> <length> [charset]
   Generates a password, puts it into the database and copies it to
   the clipboard.
 
+create_gen_many <prefix> <count> <length> [charset]
+  Generates that many passwords and puts them into the database. The names are
+  the prefix followed by 0, 1, 2 and so on. Names that are taken are skipped.
+
 change <name> <new_password>
   If name is an unambiguous substring then that password is changed.
 
@@ -82,7 +148,7 @@ rename <name> <new_name>
 
 rename_s <index> <new_name>
   The password in the most recent search with that index is renamed.
-  
+
 get <name>
   If name is an unambiguous substring then that password is printed.
 
@@ -136,13 +202,22 @@ rem_s <index>
     );
     std::cout << "\"\n";
   }
-
+  
   void helpCommand() {
     std::cout << HELP_TEXT;
   }
+  
+  //The database is written again once the journal is this many bytes
+  constexpr size_t JOURNAL_COMPACT_SIZE = 1024 * 1024;
 }
 
-CommandInterpreter::CommandInterpreter() {
+CommandInterpreter::CommandInterpreter()
+  : file(),
+    passwords(),
+    journal(),
+    writing(),
+    searchResults(),
+    words() {
   std::cout << "Welcome to PassMan!\n";
   std::cout << "Type \"help\" for a list of commands.\n";
   std::cout << '\n';
@@ -170,21 +245,39 @@ void CommandInterpreter::interpret(
   #define COMMAND_IS(COMMAND_NAME)                                              \
     const auto name = #COMMAND_NAME##_sv;                                       \
     commandIs(command, name)
-
+  
   #define ARGUMENTS command.substr(name.size())
   
+  checkWriting(false);
+  
   if (COMMAND_IS(help)) {
     helpCommand();
   } else if (COMMAND_IS(open)) {
     openCommand(ARGUMENTS);
+  } else if (COMMAND_IS(verify)) {
+    verifyCommand(ARGUMENTS);
+  } else if (COMMAND_IS(lookup)) {
+    lookupCommand(ARGUMENTS);
   } else if (COMMAND_IS(close)) {
     closeCommand();
   } else if (COMMAND_IS(change_phrase)) {
     changePhraseCommand(ARGUMENTS);
+  } else if (COMMAND_IS(calibrate)) {
+    calibrateCommand(ARGUMENTS);
+  } else if (COMMAND_IS(convert_indexed)) {
+    convertIndexedCommand();
+  } else if (COMMAND_IS(convert_legacy)) {
+    convertLegacyCommand();
+  } else if (COMMAND_IS(compress)) {
+    compressCommand();
+  } else if (COMMAND_IS(decompress)) {
+    decompressCommand();
   } else if (COMMAND_IS(clear)) {
     clearCommand();
   } else if (COMMAND_IS(flush)) {
-    flushCommand();
+    flushCommand(true);
+  } else if (COMMAND_IS(status)) {
+    statusCommand();
   } else if (COMMAND_IS(quit)) {
     quitCommand();
   } else if (COMMAND_IS(quit_no_flush)) {
@@ -201,12 +294,18 @@ void CommandInterpreter::interpret(
     countCommand();
   } else if (COMMAND_IS(gen)) {
     genCommand(ARGUMENTS);
+  } else if (COMMAND_IS(gen_many)) {
+    genManyCommand(ARGUMENTS);
+  } else if (COMMAND_IS(gen_phrase)) {
+    genPhraseCommand(ARGUMENTS);
   } else if (COMMAND_IS(create)) {
     createCommand(ARGUMENTS);
   } else if (COMMAND_IS(create_gen)) {
     createGenCommand(ARGUMENTS);
   } else if (COMMAND_IS(create_gen_copy)) {
     createGenCopyCommand(ARGUMENTS);
+  } else if (COMMAND_IS(create_gen_many)) {
+    createGenManyCommand(ARGUMENTS);
   } else if (COMMAND_IS(change)) {
     changeCommand(ARGUMENTS);
   } else if (COMMAND_IS(change_s)) {
@@ -231,8 +330,9 @@ void CommandInterpreter::interpret(
     unknownCommand(command);
   }
   
+  writeChanges();
   std::cout.flush();
-
+  
   #undef ARGUMENTS
   #undef COMMAND_IS
 }
@@ -266,7 +366,7 @@ namespace {
     args.remove_prefix(end - args.data());
     return arg;
   }
-
+  
   std::string readString(std::experimental::string_view &args) {
     if (args.empty()) {
       throw std::runtime_error("Expected string");
@@ -313,7 +413,7 @@ namespace {
     
     return arg;
   }
-
+  
   bool fileExists(const char *const path) {
     std::unique_ptr<std::FILE, decltype(&std::fclose)> file(
       fopen(path, "r"),
@@ -321,7 +421,7 @@ namespace {
     );
     return bool(file);
   }
-
+  
   void nextArg(std::experimental::string_view &args, const char *signature) {
     if (args.empty() || args[0] != ' ') {
       throw std::runtime_error(std::string("Command signature is:\n") + signature);
@@ -358,16 +458,81 @@ namespace {
     
     forEach(output, [arguments, signature] (auto &element) mutable {
       using ElementType = std::decay_t<decltype(element)>;
-      nextArg(arguments, signature);
-      if constexpr (std::is_same<ElementType, std::string>::value) {
-        element = readString(arguments);
-      } else if (std::is_integral<ElementType>::value) {
-        element = readNumber(arguments);
+      using OptionalString = std::experimental::optional<std::string>;
+      if constexpr (std::is_same<ElementType, OptionalString>::value) {
+        //optional arguments can only be at the end
+        if (!arguments.empty()) {
+          nextArg(arguments, signature);
+          element = readString(arguments);
+        }
+      } else {
+        nextArg(arguments, signature);
+        if constexpr (std::is_same<ElementType, std::string>::value) {
+          element = readString(arguments);
+        } else if (std::is_integral<ElementType>::value) {
+          element = readNumber(arguments);
+        }
       }
     });
     
     return output;
   }
+  
+  //The charset is an optional argument to every command that generates
+  //passwords
+  CharTable readCharTable(const std::experimental::optional<std::string> &name) {
+    if (name) {
+      return charTable(*name);
+    } else {
+      return CHAR_TABLE<AlnumCharset>;
+    }
+  }
+  
+  using Clock = std::chrono::steady_clock;
+  
+  long long toMilliseconds(const Clock::duration duration) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+  }
+  
+  //Reads the file on another thread while the key is derived so decryption
+  //can start as soon as the key is ready
+  std::pair<Key, Passwords> deriveKeyAndDecrypt(
+    const std::experimental::string_view phrase,
+    const std::string &path
+  ) {
+    const Clock::time_point start = Clock::now();
+    auto reading = std::async(std::launch::async, [&path] {
+      const Clock::time_point readStart = Clock::now();
+      EncryptedFile file(path);
+      return std::make_pair(std::move(file), Clock::now() - readStart);
+    });
+    
+    Key key = generateKey(phrase, readKeyParams(path));
+    const Clock::duration keyTime = Clock::now() - start;
+    const auto [file, readTime] = reading.get();
+    const Clock::duration bothTime = Clock::now() - start;
+    
+    std::cout << "Derived the key in " << toMilliseconds(keyTime)
+              << " ms and read the file in " << toMilliseconds(readTime)
+              << " ms\n";
+    std::cout << "Reading while deriving saved "
+              << toMilliseconds(keyTime + readTime - bothTime) << " ms\n";
+    
+    //entries are parsed while the rest of the file is decrypted and the
+    //encrypted pages are dropped as they're used so the file is never in
+    //memory twice
+    {
+      PasswordsReader reader;
+      const bool authentic = decryptPieces(
+        key, file, reader.file(), [&reader] { reader.update(); }
+      );
+      if (authentic) {
+        return {key, reader.finish()};
+      }
+    }
+    //files from older versions are decrypted all at once
+    return {key, readPasswords(decryptFile(key, file))};
+  }
 }
 
 void CommandInterpreter::openCommand(
@@ -377,9 +542,21 @@ void CommandInterpreter::openCommand(
     arguments,
     "open <phrase> <file>"
   );
-  const uint64_t newKey = generateKey(phrase);
+  //the file might be the one that is open so every change has to be in the
+  //file and the journal before they're read
+  if (passwords) {
+    flushCommand();
+  }
+  Key newKey;
+  Passwords newPasswords;
+  std::experimental::optional<Compression> fileCompression = Compression::none;
+  std::unique_ptr<Journal> newJournal;
+  size_t replayed = 0;
   
-  if (!fileExists(newFile.c_str())) {
+  if (fileExists(newFile.c_str())) {
+    std::tie(newKey, newPasswords) = deriveKeyAndDecrypt(phrase, newFile);
+    fileCompression = readCompression(newFile);
+  } else {
     std::FILE *fileStream = std::fopen(newFile.c_str(), "w");
     if (fileStream == nullptr) {
       std::cout << "Failed to create file \"" << newFile.c_str() << "\"\n";
@@ -388,25 +565,129 @@ void CommandInterpreter::openCommand(
     std::cout << "Created a new file named \"" << newFile.c_str() << "\"\n";
     
     std::fclose(fileStream);
-    encryptFile(newKey, newFile, "");
+    newKey = generateKey(phrase, newKeyParams());
+    //the new file has the header and the empty index of the indexed layout
+    //so that it can be looked up
+    EncryptedWriter writer(newKey, newFile);
+    writePasswords(newPasswords, [&writer] (const std::experimental::string_view str) {
+      writer.write(str);
+    });
+    writer.finish();
   }
   
-  if (passwords) {
-    flushCommand();
+  //files from older versions don't have a journal
+  if (const auto nonce = readFileNonce(newFile)) {
+    newJournal = std::make_unique<Journal>(newFile, newKey, *nonce);
+    replayed = newJournal->replay(newPasswords);
   }
   
-  passwords.emplace(readPasswords(decryptFile(newKey, newFile)));
+  passwords.emplace(std::move(newPasswords));
+  journal = std::move(newJournal);
   searchResults.clear();
   key = newKey;
   file = std::move(newFile);
+  compression = fileCompression.value_or(Compression::none);
+  flushedGeneration = generation;
   
+  if (replayed != 0) {
+    std::cout << "Replayed " << replayed << " changes from the journal\n";
+  }
   std::cout << "Opened the database\n";
 }
 
+void CommandInterpreter::verifyCommand(
+  const std::experimental::string_view arguments
+) const {
+  const auto [phrase, filePath] = readArgs<std::string, std::string>(
+    arguments,
+    "verify <phrase> <file>"
+  );
+  
+  const Key fileKey = generateKey(phrase, readKeyParams(filePath));
+  if (const auto reader = ChunkReader::open(fileKey, filePath)) {
+    const std::vector<size_t> modified = reader->modifiedChunks();
+    if (modified.empty()) {
+      std::cout << "\"" << filePath << "\" is intact\n";
+    } else {
+      std::cout << modified.size() << " of the "
+                << reader->directory().chunks.size() << " chunks of \""
+                << filePath << "\" have been modified\n";
+      for (const size_t c : modified) {
+        std::cout << "  chunk " << c << '\n';
+      }
+    }
+    //the changes in the journal haven't been written to the file yet
+    try {
+      const std::vector<std::string> records = readJournalRecords(
+        filePath, fileKey, reader->directory().nonce
+      );
+      if (!records.empty()) {
+        std::cout << "The journal of \"" << filePath << "\" is intact\n";
+      }
+    } catch (std::exception &e) {
+      std::cout << e.what() << '\n';
+    }
+  } else if (verifyFile(fileKey, filePath)) {
+    std::cout << "\"" << filePath << "\" is intact\n";
+  } else {
+    std::cout << "\"" << filePath
+              << "\" has been modified or the phrase is wrong\n";
+  }
+}
+
+void CommandInterpreter::lookupCommand(
+  const std::experimental::string_view arguments
+) const {
+  const auto [phrase, filePath, name] = readArgs<std::string, std::string, std::string>(
+    arguments,
+    "lookup <phrase> <file> <name>"
+  );
+  
+  const Key fileKey = generateKey(phrase, readKeyParams(filePath));
+  auto reader = ChunkReader::open(fileKey, filePath);
+  if (!reader) {
+    std::cout << "\"" << filePath
+              << "\" isn't split into chunks or the phrase is wrong\n";
+    return;
+  }
+  //the journal has changes that haven't been written to the file yet so the
+  //index is only searched if none of them change the entry
+  const std::vector<std::string> records = readJournalRecords(
+    filePath, fileKey, reader->directory().nonce
+  );
+  const JournalChange change = findChange(records, name);
+  std::experimental::optional<std::string> password = change.password;
+  if (!change.changed) {
+    password = findPassword(
+      reader->size(),
+      [&reader] (const size_t offset, const size_t size) {
+        return reader->read(offset, size);
+      },
+      name
+    );
+  }
+  if (password) {
+    std::cout << "Password for \""
+              << name
+              << "\" is:\n"
+              << *password
+              << '\n';
+  } else {
+    std::cout << "There is no password named \"" << name << "\"\n";
+  }
+  std::cout << "Decrypted " << reader->decrypted() << " of the "
+            << reader->directory().chunks.size() << " chunks\n";
+  if (!records.empty()) {
+    std::cout << "Read " << records.size() << " changes from the journal\n";
+  }
+}
+
 void CommandInterpreter::closeCommand() {
   flushCommand();
-  key = 0;
+  journal.reset();
+  key = {};
   file.clear();
+  compression = Compression::none;
   passwords = std::experimental::nullopt;
   searchResults.clear();
   
@@ -421,28 +702,132 @@ void CommandInterpreter::changePhraseCommand(
     arguments,
     "change_phrase <old_phrase> <new_phrase>"
   );
-  if (key != generateKey(oldPhrase)) {
+  if (generateKey(oldPhrase, key.params).derived != key.derived) {
     std::cout << "old_phrase does not match the current encryption phrase\n";
     return;
   }
   
-  key = generateKey(newPhrase);
+  key = generateKey(newPhrase, newKeyParams(key.params.cost));
+  ++generation;
   std::cout << "Encryption phrase was changed to \"" << newPhrase << "\"\n";
 }
 
+void CommandInterpreter::calibrateCommand(
+  const std::experimental::string_view arguments
+) {
+  expectInit();
+  auto [phrase, milliseconds, threads] = readArgs<std::string, uint64_t, uint32_t>(
+    arguments,
+    "calibrate <phrase> <milliseconds> <threads>"
+  );
+  if (generateKey(phrase, key.params).derived != key.derived) {
+    std::cout << "phrase does not match the current encryption phrase\n";
+    return;
+  }
+  
+  const KeyParams params = calibrateKeyParams(
+    std::chrono::milliseconds(milliseconds), threads
+  );
+  const auto start = std::chrono::steady_clock::now();
+  key = generateKey(phrase, params);
+  ++generation;
+  const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - start
+  );
+  
+  std::cout << "Key derivation uses " << params.cost.memory / 1024 << " MiB, "
+            << params.cost.passes << " passes and "
+            << params.cost.lanes << " threads\n";
+  std::cout << "Deriving the key took " << elapsed.count() << " ms\n";
+}
+
+void CommandInterpreter::convertIndexedCommand() {
+  expectInit();
+  passwords->setLayout(Layout::indexed);
+  ++generation;
+  std::cout << "The database will be written in the indexed layout when it "
+               "is flushed\n";
+}
+
+void CommandInterpreter::convertLegacyCommand() {
+  expectInit();
+  const auto entry = findNonLegacy(*passwords);
+  if (entry != passwords->cend()) {
+    std::cout << "\"" << entry->first
+              << "\" can't be written in the legacy layout because names and "
+                 "passwords can't be empty\n";
+    return;
+  }
+  passwords->setLayout(Layout::legacy);
+  ++generation;
+  std::cout << "The database will be written in the legacy layout when it "
+               "is flushed\n";
+}
+
+void CommandInterpreter::compressCommand() {
+  expectInit();
+  compression = Compression::lz4;
+  ++generation;
+  std::cout << "The database will be compressed when it is flushed\n";
+}
+
+void CommandInterpreter::decompressCommand() {
+  expectInit();
+  compression = Compression::none;
+  ++generation;
+  std::cout << "The database won't be compressed when it is flushed\n";
+}
+
 void CommandInterpreter::clearCommand() {
   if (passwords) {
     passwords->clear();
+    ++generation;
     searchResults.clear();
     std::cout << "Database cleared\n";
   }
 }
 
-void CommandInterpreter::flushCommand() const {
-  if (passwords) {
-    encryptFile(key, file, writePasswords(*passwords));
-    std::cout << "Database flushed\n";
+//Files from older versions don't have a journal. Opening one doesn't change
+//it so it's only upgraded when it's changed or when the user flushes it
+void CommandInterpreter::flushCommand(const bool upgrade) {
+  if (!passwords) {
+    return;
+  }
+  const bool written = checkWriting(true);
+  if (generation == flushedGeneration && (journal || !upgrade)) {
+    std::cout << (written ? "Database flushed\n" : "Database is unchanged\n");
+    return;
+  }
+  EncryptedWriter writer(key, file, compression);
+  writePasswords(*passwords, [&writer] (const std::experimental::string_view str) {
+    writer.write(str);
+  });
+  writer.finish();
+  flushedGeneration = generation;
+  //the new file has every change so the journal starts again for it
+  journal.reset();
+  journal = std::make_unique<Journal>(file, key, writer.fileNonce());
+  std::cout << "Database flushed\n";
+}
+
+void CommandInterpreter::statusCommand() const {
+  expectInit();
+  
+  if (generation == flushedGeneration) {
+    std::cout << "\"" << file << "\" is up to date\n";
+  } else if (writing.valid() && generation == writingGeneration) {
+    std::cout << "\"" << file << "\" is being written\n";
+  } else {
+    std::cout << "\"" << file << "\" has changes that haven't been flushed\n";
+  }
+  if (journal) {
+    if (journal->records() == 1) {
+      std::cout << "The journal has 1 change\n";
+    } else {
+      std::cout << "The journal has " << journal->records() << " changes\n";
+    }
   }
+  countCommand();
 }
 
 void CommandInterpreter::quitCommand() {
@@ -479,7 +864,7 @@ void CommandInterpreter::unDumpCommand(
   const std::experimental::string_view arguments
 ) {
   expectInit();
-
+  
   auto [filePath] = readArgs<std::string>(arguments, "undump <file>");
   
   std::ifstream file(filePath, std::ifstream::binary);
@@ -501,7 +886,7 @@ void CommandInterpreter::unDumpCommand(
       break;
     }
     
-    passwords->emplace(name, password + 4);
+    generation += passwords->emplace(name, password + 4).second;
   }
   
   countCommand();
@@ -515,6 +900,101 @@ void CommandInterpreter::expectInit() const {
   }
 }
 
+//A change is appended to the journal if the file (or the file that is being
+//written) and the journal hold every other change. Otherwise the whole
+//database is written after the command
+void CommandInterpreter::journalChange(
+  const std::function<void (Journal &)> &append
+) {
+  const uint64_t onDisk = writing.valid() ? writingGeneration : flushedGeneration;
+  if (!journal || generation != onDisk) {
+    ++generation;
+    return;
+  }
+  try {
+    append(*journal);
+  } catch (...) {
+    ++generation;
+    throw;
+  }
+  if (journal->size() >= JOURNAL_COMPACT_SIZE && !writing.valid()) {
+    startWriting();
+  }
+}
+
+//Changes that the journal can't hold are written after every command. If the
+//database is already being written then that has to finish first
+void CommandInterpreter::writeChanges() {
+  if (!passwords || quit) {
+    return;
+  }
+  const uint64_t onDisk = writing.valid() ? writingGeneration : flushedGeneration;
+  if (generation == onDisk) {
+    return;
+  }
+  checkWriting(true);
+  if (generation != flushedGeneration) {
+    startWriting();
+  }
+}
+
+//The table is copied so that the database can be changed while the copy is
+//written on another thread. The copy shares the names and passwords so the
+//file is still encrypted two buffers at a time. Changes made until the new
+//file replaces the old one are journaled for the new file (and for the old
+//one if it's up to date)
+void CommandInterpreter::startWriting() {
+  auto writer = std::make_unique<EncryptedWriter>(key, file, compression);
+  if (!journal) {
+    //files from older versions don't have a journal
+    journal = std::make_unique<Journal>(file, key, writer->fileNonce());
+  }
+  journal->beginCompaction(
+    key, writer->fileNonce(), generation == flushedGeneration
+  );
+  writingGeneration = generation;
+  writing = std::async(
+    std::launch::async,
+    [writer = std::move(writer), snapshot = passwords->snapshot()] {
+      writePasswords(snapshot, [&writer] (const std::experimental::string_view str) {
+        writer->write(str);
+      });
+      writer->finish();
+    }
+  );
+}
+
+//Checks whether the database has been written or waits for it. Returns true
+//if it was written
+bool CommandInterpreter::checkWriting(const bool wait) {
+  if (!writing.valid()) {
+    return false;
+  }
+  if (
+    !wait &&
+    writing.wait_for(std::chrono::seconds(0)) != std::future_status::ready
+  ) {
+    return false;
+  }
+  try {
+    writing.get();
+  } catch (std::exception &e) {
+    journal->abortCompaction();
+    std::cout << "Failed to write the database: " << e.what() << '\n';
+    return false;
+  }
+  flushedGeneration = writingGeneration;
+  try {
+    journal->finishCompaction();
+  } catch (std::exception &e) {
+    //the file was replaced but the journal might not have every change for it
+    journal.reset();
+    ++generation;
+    std::cout << "Failed to compact the journal: " << e.what() << '\n';
+  }
+  return true;
+}
+
 namespace {
   template <typename Char>
   struct IEqual {
@@ -555,7 +1035,7 @@ void CommandInterpreter::searchCommand(
     if (findI(p.first, subString)) {
       std::cout.width(4);
       std::cout << searchResults.size() << " - " << p.first << '\n';
-      searchResults.push_back(p.first);
+      searchResults.push_back(p.first.to_string());
     }
   }
   
@@ -592,9 +1072,65 @@ void CommandInterpreter::countCommand() const {
 void CommandInterpreter::genCommand(
   const std::experimental::string_view arguments
 ) const {
-  const auto [size] = readArgs<uint64_t>(arguments, "gen <length>");
+  const auto [size, charset] = readArgs<
+    uint64_t, std::experimental::optional<std::string>
+  >(arguments, "gen <length> [charset]");
+  
+  const std::string password = generatePassword(size, readCharTable(charset));
+  std::cout << "Random password: \n" << password << '\n';
+}
+
+namespace {
+  //Every password is generated in one go
+  std::string generatePasswords(
+    const size_t count,
+    const size_t length,
+    const CharTable &table
+  ) {
+    if (length == 0) {
+      throw std::runtime_error("Invalid password length");
+    }
+    if (count > std::numeric_limits<size_t>::max() / (length + 1)) {
+      throw std::runtime_error("Too many passwords");
+    }
+    return generatePassword(count * length, table);
+  }
+}
+
+void CommandInterpreter::genManyCommand(
+  const std::experimental::string_view arguments
+) const {
+  const auto [count, length, charset] = readArgs<
+    uint64_t, uint64_t, std::experimental::optional<std::string>
+  >(arguments, "gen_many <count> <length> [charset]");
+  const std::string generated = generatePasswords(
+    count, length, readCharTable(charset)
+  );
   
-  std::cout << "Random password: \n" << generatePassword(size) << '\n';
+  std::string lines;
+  lines.reserve(count * (length + 1));
+  for (size_t i = 0; i != count; ++i) {
+    lines.append(generated, i * length, length);
+    lines.push_back('\n');
+  }
+  std::cout << lines;
+}
+
+void CommandInterpreter::genPhraseCommand(
+  const std::experimental::string_view arguments
+) {
+  const auto [count] = readArgs<uint64_t>(arguments, "gen_phrase <words>");
+  if (count == 0) {
+    throw std::runtime_error("Invalid number of words");
+  }
+  if (!words) {
+    words.emplace(defaultWordListPath());
+  }
+  
+  const std::string phrase = generatePhrase(*words, count);
+  std::cout << "Random phrase: \n" << phrase << '\n';
+  std::cout << "The phrase has " << static_cast<int>(count * std::log2(words->size()))
+            << " bits of entropy\n";
 }
 
 namespace {
@@ -689,14 +1225,16 @@ Passwords::iterator CommandInterpreter::create(
   const std::string &name,
   std::string &&password
 ) {
-  //@TODO try_emplace will only move name if the emplacement is successful
-  //so we can use name if the emplacement fails.
-  const auto pair = passwords->emplace(name, std::move(password));
+  //the name and password are only copied if the entry is created
+  const auto pair = passwords->emplace(name, password);
   if (!pair.second) {
     std::cout << "Entry was not created. A password for \""
               << name
               << "\" already exists\n";
   } else {
+    journalChange([&name, &password] (Journal &journal) {
+      journal.set(name, password);
+    });
     std::cout << "Created \"" << name << "\" password\n";
   }
   return pair.first;
@@ -708,7 +1246,10 @@ void CommandInterpreter::change(
 ) {
   std::cout << "Changed \"" << entry->first << "\" password\n";
   std::cout << "Old password was: \n" << entry->second << '\n';
-  entry->second = std::move(password);
+  passwords->assign(entry, password);
+  journalChange([entry, &password] (Journal &journal) {
+    journal.set(entry->first, password);
+  });
 }
 
 void CommandInterpreter::createCommand(
@@ -726,29 +1267,57 @@ void CommandInterpreter::createGenCommand(
   const std::experimental::string_view arguments
 ) {
   expectInit();
-  auto [name, length] = readArgs<std::string, size_t>(
-    arguments,
-    "create_gen <name> <length>"
-  );
+  auto [name, length, charset] = readArgs<
+    std::string, size_t, std::experimental::optional<std::string>
+  >(arguments, "create_gen <name> <length> [charset]");
   if (length == 0) {
     throw std::runtime_error("Invalid password length");
   }
-  create(name, generatePassword(length));
+  create(name, generatePassword(length, readCharTable(charset)));
 }
 
 void CommandInterpreter::createGenCopyCommand(
   const std::experimental::string_view arguments
 ) {
   expectInit();
-  auto [name, length] = readArgs<std::string, size_t>(
-    arguments,
-    "create_gen_copy <name> <length>"
-  );
+  auto [name, length, charset] = readArgs<
+    std::string, size_t, std::experimental::optional<std::string>
+  >(arguments, "create_gen_copy <name> <length> [charset]");
   if (length == 0) {
     throw std::runtime_error("Invalid password length");
   }
   //Wow!
-  copy(create(name, generatePassword(length)));
+  copy(create(name, generatePassword(length, readCharTable(charset))));
+}
+
+void CommandInterpreter::createGenManyCommand(
+  const std::experimental::string_view arguments
+) {
+  expectInit();
+  auto [prefix, count, length, charset] = readArgs<
+    std::string, size_t, size_t, std::experimental::optional<std::string>
+  >(arguments, "create_gen_many <prefix> <count> <length> [charset]");
+  const std::string generated = generatePasswords(
+    count, length, readCharTable(charset)
+  );
+  
+  passwords->reserve(passwords->size() + count);
+  size_t created = 0;
+  std::string name = prefix;
+  for (size_t i = 0; i != count; ++i) {
+    name.resize(prefix.size());
+    name += std::to_string(i);
+    const auto password = std::experimental::string_view(generated).substr(
+      i * length, length
+    );
+    created += passwords->emplace(name, password).second;
+  }
+  
+  generation += created;
+  std::cout << "Created " << created << " passwords\n";
+  if (created != count) {
+    std::cout << (count - created) << " names were taken\n";
+  }
 }
 
 void CommandInterpreter::changeCommand(
@@ -789,8 +1358,15 @@ void CommandInterpreter::rename(
   
   std::cout << "Renamed \"" << entry->first << "\" to \"" << newName << "\"\n";
   
-  passwords->emplace(std::move(newName), std::move(entry->second));
+  //emplace can move every entry so the old entry is erased first. The
+  //password that it points to stays in memory
+  const auto password = entry->second;
+  const std::string oldName = entry->first.to_string();
   passwords->erase(entry);
+  passwords->emplace(newName, password);
+  journalChange([&oldName, &newName, password] (Journal &journal) {
+    journal.rename(oldName, newName, password);
+  });
 }
 
 void CommandInterpreter::get(const Passwords::const_iterator entry) const {
@@ -840,7 +1416,7 @@ void CommandInterpreter::getSCommand(
 }
 
 void CommandInterpreter::copy(const Passwords::const_iterator entry) const {
-  writeToClipboard(entry->second);
+  writeToClipboard(entry->second.to_string());
   
   std::cout << "Password for \""
             << entry->first
@@ -851,7 +1427,11 @@ void CommandInterpreter::rem(const Passwords::iterator entry) {
   std::cout << "Password for \""
             << entry->first
             << "\" was removed from the database\n";
+  const std::string name = entry->first.to_string();
   passwords->erase(entry);
+  journalChange([&name] (Journal &journal) {
+    journal.remove(name);
+  });
 }
 
 void CommandInterpreter::copyCommand(
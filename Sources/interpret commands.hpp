@@ -9,8 +9,13 @@
 #ifndef interpret_commands_hpp
 #define interpret_commands_hpp
 
+#include <future>
+#include <memory>
 #include <vector>
 #include "parse.hpp"
+#include "encrypt.hpp"
+#include "journal.hpp"
+#include "word list.hpp"
 #include <experimental/optional>
 #include <experimental/string_view>
 
@@ -30,17 +35,39 @@ public:
   void sessionExpired();
 
 private:
-  size_t key = 0;
+  Key key = {};
   std::string file;
+  Compression compression = Compression::none;
+  //incremented by every command that changes what would be written to the
+  //file
+  uint64_t generation = 0;
+  //the generation that was last written to the file
+  uint64_t flushedGeneration = 0;
   std::experimental::optional<Passwords> passwords;
+  //changes are appended to the journal while the file is up to date
+  std::unique_ptr<Journal> journal;
+  //the database being written to a new file in the background
+  std::future<void> writing;
+  //the generation that is being written
+  uint64_t writingGeneration = 0;
   std::vector<std::string> searchResults;
+  //mapped the first time a phrase is generated
+  std::experimental::optional<WordList> words;
   bool quit = false;
   
   void openCommand(std::experimental::string_view);
+  void verifyCommand(std::experimental::string_view) const;
+  void lookupCommand(std::experimental::string_view) const;
   void closeCommand();
   void changePhraseCommand(std::experimental::string_view);
+  void calibrateCommand(std::experimental::string_view);
+  void convertIndexedCommand();
+  void convertLegacyCommand();
+  void compressCommand();
+  void decompressCommand();
   void clearCommand();
-  void flushCommand() const;
+  void flushCommand(bool = false);
+  void statusCommand() const;
   void quitCommand();
   
   void quitNoFlushCommand();
@@ -49,10 +76,17 @@ private:
   
   void expectInit() const;
   
+  void journalChange(const std::function<void (Journal &)> &);
+  void writeChanges();
+  void startWriting();
+  bool checkWriting(bool);
+  
   void searchCommand(std::experimental::string_view);
   void listCommand() const;
   void countCommand() const;
   void genCommand(std::experimental::string_view) const;
+  void genManyCommand(std::experimental::string_view) const;
+  void genPhraseCommand(std::experimental::string_view);
   
   Passwords::iterator uniqueSearch(std::experimental::string_view);
   Passwords::iterator getFromIndex(size_t);
@@ -63,6 +97,7 @@ private:
   void createCommand(std::experimental::string_view);
   void createGenCommand(std::experimental::string_view);
   void createGenCopyCommand(std::experimental::string_view);
+  void createGenManyCommand(std::experimental::string_view);
   void changeCommand(std::experimental::string_view);
   void changeSCommand(std::experimental::string_view);
   
@@ -0,0 +1,365 @@
+//
+//  journal.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 19/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "journal.hpp"
+
+#include <chrono>
+#include <stdexcept>
+#include "sync file.hpp"
+
+/*
+
+record
+  change
+    type
+    size of name
+    name
+    size of password (set only)
+    password (set only)
+
+*/
+
+namespace {
+  using View = std::experimental::string_view;
+  using File = std::unique_ptr<std::FILE, decltype(&std::fclose)>;
+  
+  //Changes that are made this close together are synced together
+  constexpr std::chrono::milliseconds GROUP_COMMIT_WINDOW(10);
+  
+  enum class Change : char {
+    set = 1,
+    remove = 2
+  };
+  
+  void appendField(std::string &record, const View field) {
+    const uint32_t size = static_cast<uint32_t>(field.size());
+    for (size_t i = 0; i != sizeof(uint32_t); ++i) {
+      record.push_back(static_cast<char>(size >> (i * 8)));
+    }
+    record.append(field.data(), field.size());
+  }
+  
+  View readField(View &record) {
+    if (record.size() < sizeof(uint32_t)) {
+      throw std::runtime_error("The journal is invalid");
+    }
+    uint32_t size = 0;
+    for (size_t i = 0; i != sizeof(uint32_t); ++i) {
+      size |= uint32_t(uint8_t(record[i])) << (i * 8);
+    }
+    record.remove_prefix(sizeof(uint32_t));
+    if (record.size() < size) {
+      throw std::runtime_error("The journal is invalid");
+    }
+    const View field = record.substr(0, size);
+    record.remove_prefix(size);
+    return field;
+  }
+  
+  void appendSet(std::string &record, const View name, const View password) {
+    record.push_back(static_cast<char>(Change::set));
+    appendField(record, name);
+    appendField(record, password);
+  }
+  
+  void appendRemove(std::string &record, const View name) {
+    record.push_back(static_cast<char>(Change::remove));
+    appendField(record, name);
+  }
+  
+  //Calls set with the name and password or remove with the name for every
+  //change in the record
+  template <typename Set, typename Remove>
+  void readChanges(View record, Set &&set, Remove &&remove) {
+    while (!record.empty()) {
+      const Change change = static_cast<Change>(record[0]);
+      record.remove_prefix(1);
+      const View name = readField(record);
+      if (change == Change::set) {
+        set(name, readField(record));
+      } else if (change == Change::remove) {
+        remove(name);
+      } else {
+        throw std::runtime_error("The journal is invalid");
+      }
+    }
+  }
+  
+  void applyRecord(Passwords &passwords, const View record) {
+    readChanges(record, [&passwords] (const View name, const View password) {
+      const auto entry = passwords.find(name);
+      if (entry == passwords.end()) {
+        passwords.emplace(name, password);
+      } else {
+        passwords.assign(entry, password);
+      }
+    }, [&passwords] (const View name) {
+      const auto entry = passwords.find(name);
+      if (entry != passwords.end()) {
+        passwords.erase(entry);
+      }
+    });
+  }
+  
+  std::string readJournal(const std::string &path) {
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+      return {};
+    }
+    File stream(file, &std::fclose);
+    
+    std::string journal;
+    char buf[64 * 1024];
+    size_t size;
+    while ((size = std::fread(buf, 1, sizeof(buf), stream.get())) != 0) {
+      journal.append(buf, size);
+    }
+    if (std::ferror(stream.get())) {
+      throw std::runtime_error("Failed to read the journal");
+    }
+    return journal;
+  }
+  
+  void writeRecord(std::FILE *file, const std::string &record) {
+    if (
+      std::fwrite(record.data(), 1, record.size(), file) != record.size() ||
+      std::fflush(file) != 0
+    ) {
+      throw std::runtime_error("Failed to write to the journal");
+    }
+  }
+  
+  File openAppend(const std::string &path) {
+    std::FILE *file = std::fopen(path.c_str(), "ab");
+    if (file == nullptr) {
+      throw std::runtime_error("Failed to open the journal \"" + path + "\"");
+    }
+    return File(file, &std::fclose);
+  }
+}
+
+Journal::Journal(
+  const View databasePath,
+  const Key &key,
+  const uint64_t fileNonce
+) : path(databasePath.to_string() + ".journal"),
+    key(key),
+    fileNonce(fileNonce),
+    file(nullptr, &std::fclose),
+    opened(),
+    newKey(),
+    newFileNonce(),
+    newRecords(),
+    mutex(),
+    wake(),
+    syncer() {
+  const std::string journal = readJournal(path);
+  JournalRecords records = openRecords(key, fileNonce, journal);
+  opened = std::move(records.records);
+  count = opened.size();
+  if (records.stale) {
+    rewrite(fileNonce, opened);
+  } else {
+    bytes = journal.size();
+    file = openAppend(path);
+  }
+  syncer = std::thread([this] {
+    syncLoop();
+  });
+}
+
+Journal::~Journal() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  syncer.join();
+}
+
+size_t Journal::replay(Passwords &passwords) {
+  const size_t replayed = opened.size();
+  for (const std::string &record : opened) {
+    applyRecord(passwords, record);
+  }
+  opened.clear();
+  opened.shrink_to_fit();
+  return replayed;
+}
+
+void Journal::set(const View name, const View password) {
+  std::string record;
+  appendSet(record, name, password);
+  append(record);
+}
+
+void Journal::remove(const View name) {
+  std::string record;
+  appendRemove(record, name);
+  append(record);
+}
+
+void Journal::rename(
+  const View oldName,
+  const View newName,
+  const View password
+) {
+  std::string record;
+  appendRemove(record, oldName);
+  appendSet(record, newName, password);
+  append(record);
+}
+
+size_t Journal::size() const {
+  return bytes;
+}
+
+size_t Journal::records() const {
+  return count;
+}
+
+void Journal::beginCompaction(
+  const Key &key,
+  const uint64_t nonce,
+  const bool upToDate
+) {
+  newKey = key;
+  newFileNonce = nonce;
+  newRecords.clear();
+  behind = !upToDate;
+}
+
+void Journal::finishCompaction() {
+  if (!newFileNonce) {
+    return;
+  }
+  const uint64_t nonce = *newFileNonce;
+  std::vector<std::string> records = std::move(newRecords);
+  newFileNonce = std::experimental::nullopt;
+  newRecords.clear();
+  //the phrase might have changed
+  key = newKey;
+  rewrite(nonce, records);
+  fileNonce = nonce;
+  count = records.size();
+  behind = false;
+}
+
+void Journal::abortCompaction() {
+  newFileNonce = std::experimental::nullopt;
+  newRecords.clear();
+}
+
+void Journal::append(const std::string &data) {
+  std::lock_guard<std::mutex> lock(mutex);
+  //a rewrite failed
+  if (!file) {
+    throw std::runtime_error("The journal isn't open");
+  }
+  if (syncFailed) {
+    throw std::runtime_error("Failed to sync the journal");
+  }
+  if (!behind) {
+    const std::string record = sealRecord(key, fileNonce, count, data);
+    writeRecord(file.get(), record);
+    bytes += record.size();
+    ++count;
+  }
+  if (newFileNonce) {
+    const std::string newRecord = sealRecord(
+      newKey, *newFileNonce, newRecords.size(), data
+    );
+    writeRecord(file.get(), newRecord);
+    bytes += newRecord.size();
+    newRecords.push_back(data);
+  }
+  pending = true;
+  wake.notify_one();
+}
+
+//The new journal replaces the old one all at once so records are never lost
+void Journal::rewrite(
+  const uint64_t nonce,
+  const std::vector<std::string> &records
+) {
+  std::lock_guard<std::mutex> lock(mutex);
+  //the new journal is synced before it replaces the old one
+  pending = false;
+  file.reset();
+  const std::string tempPath = path + ".tmp";
+  File temp(std::fopen(tempPath.c_str(), "wb"), &std::fclose);
+  if (!temp) {
+    throw std::runtime_error("Failed to open the journal \"" + tempPath + "\"");
+  }
+  size_t size = 0;
+  for (size_t r = 0; r != records.size(); ++r) {
+    const std::string record = sealRecord(key, nonce, r, records[r]);
+    writeRecord(temp.get(), record);
+    size += record.size();
+  }
+  const bool synced = syncFile(temp.get());
+  if (std::fclose(temp.release()) != 0 || !synced) {
+    std::remove(tempPath.c_str());
+    throw std::runtime_error("Failed to write to the journal");
+  }
+  if (!replaceFile(tempPath.c_str(), path.c_str())) {
+    std::remove(tempPath.c_str());
+    throw std::runtime_error("Failed to replace the journal \"" + path + "\"");
+  }
+  bytes = size;
+  file = openAppend(path);
+}
+
+void Journal::syncLoop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wake.wait(lock, [this] {
+      return pending || stopping;
+    });
+    if (!pending) {
+      return;
+    }
+    //changes that are appended during the window are synced with this one.
+    //Nothing is waited for when the journal is closing
+    wake.wait_for(lock, GROUP_COMMIT_WINDOW, [this] {
+      return stopping;
+    });
+    pending = false;
+    if (file && !syncFile(file.get())) {
+      syncFailed = true;
+    }
+  }
+}
+
+std::vector<std::string> readJournalRecords(
+  const View databasePath,
+  const Key &key,
+  const uint64_t fileNonce
+) {
+  const std::string journal = readJournal(databasePath.to_string() + ".journal");
+  return openRecords(key, fileNonce, journal).records;
+}
+
+JournalChange findChange(
+  const std::vector<std::string> &records,
+  const View name
+) {
+  JournalChange change = {false, std::experimental::nullopt};
+  for (const std::string &record : records) {
+    readChanges(record, [&change, name] (const View other, const View password) {
+      if (other == name) {
+        change = {true, password.to_string()};
+      }
+    }, [&change, name] (const View other) {
+      if (other == name) {
+        change = {true, std::experimental::nullopt};
+      }
+    });
+  }
+  return change;
+}
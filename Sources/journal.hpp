@@ -0,0 +1,125 @@
+//
+//  journal.hpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 19/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#ifndef journal_hpp
+#define journal_hpp
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <condition_variable>
+#include "parse.hpp"
+#include "encrypt.hpp"
+#include <experimental/optional>
+#include <experimental/string_view>
+
+//Changes to entries that are appended to a file next to the database so that
+//a change doesn't rewrite the whole database. The journal is replayed on top
+//of the database when it's opened.
+//
+//While the database is being compacted, each change is recorded for both the
+//current file and the file that will replace it. Whichever file is there
+//after a crash gets every change.
+//
+//Each change is written as soon as it's made but the file is synced on
+//another thread a few milliseconds later so that a burst of changes is only
+//synced once.
+class Journal {
+  using View = std::experimental::string_view;
+
+public:
+  //Opens the journal of the database file with the nonce. Records for other
+  //files and a record that was cut off are removed
+  Journal(View, const Key &, uint64_t);
+  Journal(const Journal &) = delete;
+  //Waits until every change is on the disk
+  ~Journal();
+  
+  Journal &operator=(const Journal &) = delete;
+  
+  //Applies the records that were in the journal when it was opened. Returns
+  //the number of records
+  size_t replay(Passwords &);
+  
+  void set(View, View);
+  void remove(View);
+  //Removes the old name and sets the new one in a single record
+  void rename(View, View, View);
+  
+  //The size of the file
+  size_t size() const;
+  //The number of changes for the database file
+  size_t records() const;
+  
+  //Changes are also recorded for the file with the key and nonce until the
+  //compaction is finished. If the database file is behind the database then
+  //changes are only recorded for the new file
+  void beginCompaction(const Key &, uint64_t, bool);
+  //The database file was replaced so only the records for the new file are
+  //kept. Does nothing if a compaction hasn't begun
+  void finishCompaction();
+  //The database file wasn't replaced
+  void abortCompaction();
+
+private:
+  std::string path;
+  Key key;
+  uint64_t fileNonce;
+  std::unique_ptr<std::FILE, decltype(&std::fclose)> file;
+  size_t bytes = 0;
+  size_t count = 0;
+  //the records that haven't been replayed yet
+  std::vector<std::string> opened;
+  //the file that the database is being compacted into
+  Key newKey;
+  std::experimental::optional<uint64_t> newFileNonce;
+  std::vector<std::string> newRecords;
+  //changes aren't recorded for the database file
+  bool behind = false;
+  
+  //guards the file while it's being synced
+  std::mutex mutex;
+  std::condition_variable wake;
+  //changes have been written but haven't been synced
+  bool pending = false;
+  bool stopping = false;
+  bool syncFailed = false;
+  std::thread syncer;
+  
+  void append(const std::string &);
+  void rewrite(uint64_t, const std::vector<std::string> &);
+  void syncLoop();
+};
+
+//The records of the journal of the database file with the nonce without
+//opening the journal for changes. Records for other files and a record that
+//was cut off are skipped. Throws if a record has been modified
+std::vector<std::string> readJournalRecords(
+  std::experimental::string_view,
+  const Key &,
+  uint64_t
+);
+
+struct JournalChange {
+  //none of the records change the entry
+  bool changed;
+  //nullopt if the entry was removed
+  std::experimental::optional<std::string> password;
+};
+
+//The last change that the records make to the entry with the name
+JournalChange findChange(
+  const std::vector<std::string> &,
+  std::experimental::string_view
+);
+
+#endif
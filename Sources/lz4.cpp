@@ -0,0 +1,255 @@
+//
+//  lz4.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 18/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "lz4.hpp"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+/*
+
+block
+  sequence
+    token
+      length of literals (high 4 bits)
+      length of match minus 4 (low 4 bits)
+    rest of length of literals (if the token has 15)
+    literals
+    offset of match (2 bytes, not in the last sequence)
+    rest of length of match (if the token has 15)
+
+*/
+
+namespace {
+  constexpr size_t MIN_MATCH = 4;
+  //The last match has to start this far from the end of the block
+  constexpr size_t MATCH_LIMIT = 12;
+  //and end this far from the end of the block
+  constexpr size_t LAST_LITERALS = 5;
+  constexpr size_t MAX_OFFSET = 65535;
+  constexpr size_t TOKEN_MAX = 15;
+  constexpr unsigned HASH_BITS = 12;
+  //Each miss in a row moves further ahead so that data that doesn't compress
+  //is skipped quickly
+  constexpr unsigned SKIP_SHIFT = 6;
+  
+  uint32_t load32(const char *bytes) {
+    uint32_t word;
+    std::memcpy(&word, bytes, sizeof(word));
+    return word;
+  }
+  
+  uint64_t load64(const char *bytes) {
+    uint64_t word;
+    std::memcpy(&word, bytes, sizeof(word));
+    return word;
+  }
+  
+  size_t hashWord(const uint32_t word) {
+    return (word * 2654435761u) >> (32 - HASH_BITS);
+  }
+  
+  //The part of a length that didn't fit in the token. Returns nullptr if there
+  //isn't room
+  char *writeLength(char *out, const char *outEnd, size_t length) {
+    for (; length >= 255; length -= 255) {
+      if (out == outEnd) {
+        return nullptr;
+      }
+      *out++ = static_cast<char>(255);
+    }
+    if (out == outEnd) {
+      return nullptr;
+    }
+    *out++ = static_cast<char>(length);
+    return out;
+  }
+  
+  //The last sequence has no match. Returns nullptr if there isn't room
+  char *writeSequence(
+    char *out,
+    const char *outEnd,
+    const char *literals,
+    const size_t literalLength,
+    const size_t offset,
+    const size_t matchLength
+  ) {
+    if (out == outEnd) {
+      return nullptr;
+    }
+    const size_t extraMatch = matchLength == 0 ? 0 : matchLength - MIN_MATCH;
+    char *const token = out++;
+    *token = static_cast<char>(
+      std::min(literalLength, TOKEN_MAX) << 4 | std::min(extraMatch, TOKEN_MAX)
+    );
+    
+    if (literalLength >= TOKEN_MAX) {
+      out = writeLength(out, outEnd, literalLength - TOKEN_MAX);
+      if (out == nullptr) {
+        return nullptr;
+      }
+    }
+    if (size_t(outEnd - out) < literalLength) {
+      return nullptr;
+    }
+    std::memcpy(out, literals, literalLength);
+    out += literalLength;
+    if (matchLength == 0) {
+      return out;
+    }
+    
+    if (outEnd - out < 2) {
+      return nullptr;
+    }
+    *out++ = static_cast<char>(offset);
+    *out++ = static_cast<char>(offset >> 8);
+    if (extraMatch >= TOKEN_MAX) {
+      out = writeLength(out, outEnd, extraMatch - TOKEN_MAX);
+    }
+    return out;
+  }
+  
+  //Adds the part of a length that didn't fit in the token
+  bool readLength(const char *&in, const char *inEnd, size_t &length) {
+    uint8_t byte;
+    do {
+      if (in == inEnd) {
+        return false;
+      }
+      byte = *in++;
+      length += byte;
+    } while (byte == 255);
+    return true;
+  }
+}
+
+size_t lz4Compress(
+  char *dst,
+  const size_t dstSize,
+  const char *src,
+  const size_t srcSize
+) {
+  char *out = dst;
+  const char *const outEnd = dst + dstSize;
+  const char *const end = src + srcSize;
+  const char *anchor = src;
+  
+  if (srcSize > MATCH_LIMIT) {
+    //positions of the last words with each hash. Candidates are compared so
+    //stale entries don't matter
+    std::array<uint32_t, size_t(1) << HASH_BITS> table;
+    table.fill(0);
+    const char *const matchLimit = end - MATCH_LIMIT;
+    const char *const extendLimit = end - LAST_LITERALS;
+    const char *pos = src + 1;
+    
+    while (pos < matchLimit) {
+      const uint32_t word = load32(pos);
+      uint32_t &slot = table[hashWord(word)];
+      const char *candidate = src + slot;
+      slot = static_cast<uint32_t>(pos - src);
+      if (size_t(pos - candidate) > MAX_OFFSET || load32(candidate) != word) {
+        pos += 1 + ((pos - anchor) >> SKIP_SHIFT);
+        continue;
+      }
+      
+      while (pos > anchor && candidate > src && pos[-1] == candidate[-1]) {
+        --pos;
+        --candidate;
+      }
+      const char *matchEnd = pos + MIN_MATCH;
+      const char *other = candidate + MIN_MATCH;
+      while (
+        matchEnd + sizeof(uint64_t) <= extendLimit &&
+        load64(matchEnd) == load64(other)
+      ) {
+        matchEnd += sizeof(uint64_t);
+        other += sizeof(uint64_t);
+      }
+      while (matchEnd < extendLimit && *matchEnd == *other) {
+        ++matchEnd;
+        ++other;
+      }
+      
+      out = writeSequence(
+        out, outEnd, anchor, pos - anchor, pos - candidate, matchEnd - pos
+      );
+      if (out == nullptr) {
+        return 0;
+      }
+      anchor = pos = matchEnd;
+    }
+  }
+  
+  out = writeSequence(out, outEnd, anchor, end - anchor, 0, 0);
+  return out == nullptr ? 0 : out - dst;
+}
+
+bool lz4Decompress(
+  char *dst,
+  const size_t dstSize,
+  const char *src,
+  const size_t srcSize
+) {
+  char *out = dst;
+  char *const outEnd = dst + dstSize;
+  const char *in = src;
+  const char *const inEnd = src + srcSize;
+  
+  while (in != inEnd) {
+    const uint8_t token = *in++;
+    size_t literalLength = token >> 4;
+    if (literalLength == TOKEN_MAX && !readLength(in, inEnd, literalLength)) {
+      return false;
+    }
+    if (
+      size_t(inEnd - in) < literalLength ||
+      size_t(outEnd - out) < literalLength
+    ) {
+      return false;
+    }
+    std::memcpy(out, in, literalLength);
+    in += literalLength;
+    out += literalLength;
+    //the last sequence ends after its literals
+    if (in == inEnd) {
+      return out == outEnd;
+    }
+    
+    if (inEnd - in < 2) {
+      return false;
+    }
+    const size_t offset = uint8_t(in[0]) | size_t(uint8_t(in[1])) << 8;
+    in += 2;
+    if (offset == 0 || offset > size_t(out - dst)) {
+      return false;
+    }
+    size_t matchLength = token & TOKEN_MAX;
+    if (matchLength == TOKEN_MAX && !readLength(in, inEnd, matchLength)) {
+      return false;
+    }
+    matchLength += MIN_MATCH;
+    if (size_t(outEnd - out) < matchLength) {
+      return false;
+    }
+    
+    //a match can overlap the bytes that it's copying to repeat them
+    const char *match = out - offset;
+    if (offset >= matchLength) {
+      std::memcpy(out, match, matchLength);
+      out += matchLength;
+    } else {
+      for (size_t i = 0; i != matchLength; ++i) {
+        *out++ = *match++;
+      }
+    }
+  }
+  return false;
+}
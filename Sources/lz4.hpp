@@ -0,0 +1,24 @@
+//
+//  lz4.hpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 18/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#ifndef lz4_hpp
+#define lz4_hpp
+
+#include <cstddef>
+
+//Compresses the source into the destination in the LZ4 block format. Matches
+//are found greedily with a small hash table so this is fast rather than
+//small. Returns the size of the compressed block or 0 if it doesn't fit in the
+//destination.
+size_t lz4Compress(char *, size_t, const char *, size_t);
+
+//Decompresses an LZ4 block into the destination. Returns false if the block
+//is invalid or doesn't decompress to exactly the size of the destination.
+bool lz4Decompress(char *, size_t, const char *, size_t);
+
+#endif
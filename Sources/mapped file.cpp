@@ -0,0 +1,110 @@
+//
+//  mapped file.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 12/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "mapped file.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILE_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+std::experimental::optional<MappedFile> MappedFile::map(
+  const char *path,
+  const Access access
+) {
+  #ifdef MAPPED_FILE_POSIX
+  const int fd = ::open(path, O_RDONLY);
+  if (fd == -1) {
+    return std::experimental::nullopt;
+  }
+  
+  struct stat info;
+  if (::fstat(fd, &info) == -1 || info.st_size <= 0) {
+    ::close(fd);
+    return std::experimental::nullopt;
+  }
+  const size_t size = static_cast<size_t>(info.st_size);
+  
+  void *const mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  //the mapping keeps the file alive so the descriptor isn't needed anymore
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return std::experimental::nullopt;
+  }
+  
+  //files that are read from front to back let the kernel read ahead
+  //aggressively and drop pages behind us
+  if (access == Access::sequential) {
+    ::madvise(mapping, size, MADV_SEQUENTIAL);
+  } else {
+    ::madvise(mapping, size, MADV_RANDOM);
+  }
+  
+  return MappedFile(static_cast<const char *>(mapping), size);
+  #else
+  static_cast<void>(path);
+  static_cast<void>(access);
+  return std::experimental::nullopt;
+  #endif
+}
+
+MappedFile::MappedFile(MappedFile &&other)
+  : mapping(other.mapping), mappingSize(other.mappingSize) {
+  other.mapping = nullptr;
+  other.mappingSize = 0;
+}
+
+MappedFile::~MappedFile() {
+  #ifdef MAPPED_FILE_POSIX
+  if (mapping) {
+    ::munmap(const_cast<char *>(mapping), mappingSize);
+  }
+  #endif
+}
+
+const char *MappedFile::data() const {
+  return mapping;
+}
+
+size_t MappedFile::size() const {
+  return mappingSize;
+}
+
+void MappedFile::load() const {
+  #ifdef MAPPED_FILE_POSIX
+  ::madvise(const_cast<char *>(mapping), mappingSize, MADV_WILLNEED);
+  //touching a byte of each page faults it in
+  const size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  volatile char sink = 0;
+  for (size_t offset = 0; offset < mappingSize; offset += pageSize) {
+    sink = mapping[offset];
+  }
+  static_cast<void>(sink);
+  #endif
+}
+
+void MappedFile::release(const size_t offset, const size_t size) const {
+  #ifdef MAPPED_FILE_POSIX
+  //pages that are partly outside the range might still be needed
+  const size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  const size_t begin = (offset + pageSize - 1) / pageSize * pageSize;
+  const size_t end = (offset + size) / pageSize * pageSize;
+  if (begin < end) {
+    ::madvise(const_cast<char *>(mapping) + begin, end - begin, MADV_DONTNEED);
+  }
+  #else
+  static_cast<void>(offset);
+  static_cast<void>(size);
+  #endif
+}
+
+MappedFile::MappedFile(const char *mapping, const size_t mappingSize)
+  : mapping(mapping), mappingSize(mappingSize) {}
@@ -0,0 +1,55 @@
+//
+//  mapped file.hpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 12/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#ifndef mapped_file_hpp
+#define mapped_file_hpp
+
+#include <cstddef>
+#include <experimental/optional>
+
+//A read-only view of a whole file that is mapped into memory
+class MappedFile {
+public:
+  //How the file will be read. This is only a hint
+  enum class Access {
+    sequential,
+    random
+  };
+
+  //Returns nullopt if the file could not be mapped (it might be empty or the
+  //platform might not support mapping)
+  static std::experimental::optional<MappedFile> map(
+    const char *,
+    Access = Access::sequential
+  );
+  
+  MappedFile(const MappedFile &) = delete;
+  MappedFile(MappedFile &&);
+  ~MappedFile();
+  
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile &operator=(MappedFile &&) = delete;
+  
+  const char *data() const;
+  size_t size() const;
+  
+  //Reads every page of the file into memory so that using the file later
+  //doesn't wait for the disk
+  void load() const;
+  //Drops every whole page in the range from memory once it has been used.
+  //The pages are read from the file again if they're used after this
+  void release(size_t, size_t) const;
+
+private:
+  MappedFile(const char *, size_t);
+
+  const char *mapping;
+  size_t mappingSize;
+};
+
+#endif
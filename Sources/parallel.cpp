@@ -0,0 +1,67 @@
+//
+//  parallel.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 13/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "parallel.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <exception>
+
+void parallelFor(
+  const size_t count,
+  const std::function<void (size_t)> &function
+) {
+  const size_t threadCount = std::min(count, parallelThreads());
+  
+  if (threadCount <= 1) {
+    for (size_t i = 0; i != count; ++i) {
+      function(i);
+    }
+    return;
+  }
+  
+  std::atomic<size_t> next(0);
+  std::exception_ptr error;
+  std::mutex errorMutex;
+  
+  auto work = [&] {
+    try {
+      for (size_t i = next++; i < count; i = next++) {
+        function(i);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(errorMutex);
+      if (!error) {
+        error = std::current_exception();
+      }
+      //stop the other threads from taking any more indicies
+      next = count;
+    }
+  };
+  
+  std::vector<std::thread> threads;
+  threads.reserve(threadCount - 1);
+  for (size_t t = 1; t != threadCount; ++t) {
+    threads.emplace_back(work);
+  }
+  //the calling thread does its share of the work too
+  work();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+size_t parallelThreads() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
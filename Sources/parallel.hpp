@@ -0,0 +1,23 @@
+//
+//  parallel.hpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 13/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#ifndef parallel_hpp
+#define parallel_hpp
+
+#include <cstddef>
+#include <functional>
+
+//Calls the function once for every index in [0, count). The indicies are
+//shared between as many threads as the hardware supports. The first exception
+//thrown by the function is rethrown once every thread has finished.
+void parallelFor(size_t, const std::function<void (size_t)> &);
+
+//The number of threads that parallelFor shares the indicies between
+size_t parallelThreads();
+
+#endif
@@ -8,54 +8,1153 @@
 
 #include "parse.hpp"
 
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include "simd.hpp"
+#include "parallel.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+  //The null characters are found on every core in ranges this big
+  constexpr size_t NULL_RANGE_SIZE = 1024 * 1024;
+  constexpr size_t NULL_RANGE_WORDS = NULL_RANGE_SIZE / 64;
+  
+  //Large databases are split into a chunk for every core. The entries of
+  //each chunk are found and hashed on their own thread and then inserted in
+  //order
+  constexpr size_t MIN_CHUNK_ENTRIES = 16 * 1024;
+  
+  /*
+  
+  control byte
+    0xxxxxxx - full (top 7 bits of the hash)
+    10000000 - empty
+    11111110 - deleted
+    11111111 - sentinel after the last slot
+  
+  */
+  
+  constexpr uint8_t EMPTY = 0x80;
+  constexpr uint8_t DELETED = 0xFE;
+  constexpr uint8_t SENTINEL = 0xFF;
+  
+  //the control byte of the end of an empty table
+  const uint8_t EMPTY_TABLE = SENTINEL;
+  
+  //The slots are probed in groups. Groups are aligned and the number of
+  //groups is a power of two
+  constexpr size_t GROUP_SIZE = 16;
+  
+  //At most 7/8 of the slots are filled
+  size_t maxFilled(const size_t capacity) {
+    return capacity - capacity / 8;
+  }
+  
+  uint8_t topBits(const size_t hash) {
+    return static_cast<uint8_t>(hash >> (sizeof(size_t) * 8 - 7));
+  }
+  
+  size_t lowestBit(const uint64_t bits) {
+    #ifdef __GNUC__
+    return __builtin_ctzll(bits);
+    #else
+    size_t index = 0;
+    while ((bits >> index & 1) == 0) {
+      ++index;
+    }
+    return index;
+    #endif
+  }
+  
+  size_t bitCount(uint64_t bits) {
+    #ifdef __GNUC__
+    return __builtin_popcountll(bits);
+    #else
+    size_t count = 0;
+    for (; bits; bits &= bits - 1) {
+      ++count;
+    }
+    return count;
+    #endif
+  }
+  
+  //The control bytes of a group. Each function returns a bit for every slot
+  //in the group
+  class Group {
+  public:
+    explicit Group(const uint8_t *ctrl)
+      #ifdef __SSE2__
+      : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl))) {}
+      #else
+      : ctrl(ctrl) {}
+      #endif
+    
+    uint32_t match(const uint8_t byte) const {
+      #ifdef __SSE2__
+      const __m128i bytes = _mm_set1_epi8(static_cast<char>(byte));
+      return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, bytes));
+      #else
+      uint32_t bits = 0;
+      for (size_t i = 0; i != GROUP_SIZE; ++i) {
+        bits |= uint32_t(ctrl[i] == byte) << i;
+      }
+      return bits;
+      #endif
+    }
+    
+    uint32_t matchEmpty() const {
+      return match(EMPTY);
+    }
+    
+    //empty or deleted
+    uint32_t matchFree() const {
+      #ifdef __SSE2__
+      return _mm_movemask_epi8(ctrl);
+      #else
+      uint32_t bits = 0;
+      for (size_t i = 0; i != GROUP_SIZE; ++i) {
+        bits |= uint32_t(ctrl[i] >> 7) << i;
+      }
+      return bits;
+      #endif
+    }
+  
+  private:
+    #ifdef __SSE2__
+    __m128i ctrl;
+    #else
+    const uint8_t *ctrl;
+    #endif
+  };
+  
+  //A bitmap of the null characters in a file. Null characters before the
+  //start are left out
+  class Nulls {
+  public:
+    explicit Nulls(
+      const std::experimental::string_view file,
+      const size_t start = 0
+    ) : size(file.size()),
+        //the bitmap starts at a multiple of 64 bytes
+        base(start / 64 * 64),
+        words((size - base + 63) / 64),
+        bitmap(new uint64_t[words]),
+        rangeCounts((size - base + NULL_RANGE_SIZE - 1) / NULL_RANGE_SIZE) {
+      parallelFor(rangeCounts.size(), [this, file] (const size_t r) {
+        const size_t begin = r * NULL_RANGE_SIZE;
+        rangeCounts[r] = byteBitmap(
+          bitmap.get() + begin / 64,
+          file.data() + base + begin,
+          std::min(NULL_RANGE_SIZE, size - base - begin),
+          '\0'
+        );
+      });
+      if (start != base) {
+        const uint64_t before = bitmap[0] & ~(~uint64_t(0) << (start - base));
+        bitmap[0] &= ~before;
+        rangeCounts[0] -= bitCount(before);
+      }
+    }
+    
+    size_t count() const {
+      return std::accumulate(rangeCounts.cbegin(), rangeCounts.cend(), size_t(0));
+    }
+    
+    //The position of the nth null character
+    size_t find(size_t n) const {
+      size_t word = 0;
+      for (const size_t rangeCount : rangeCounts) {
+        if (n < rangeCount) break;
+        n -= rangeCount;
+        word += NULL_RANGE_WORDS;
+      }
+      while (n >= bitCount(bitmap[word])) {
+        n -= bitCount(bitmap[word]);
+        ++word;
+      }
+      uint64_t bits = bitmap[word];
+      for (; n != 0; --n) {
+        bits &= bits - 1;
+      }
+      return base + word * 64 + lowestBit(bits);
+    }
+    
+    //Steps through the null characters at or after a position. The size of
+    //the file is returned when there are no more
+    class Cursor {
+    public:
+      Cursor(const Nulls &nulls, const size_t pos)
+        : nulls(nulls), word(0), bits(0) {
+        //the bitmap doesn't go back any further than the start
+        const size_t offset = std::max(pos, nulls.base) - nulls.base;
+        word = offset / 64;
+        if (word < nulls.words) {
+          bits = nulls.bitmap[word] & ~uint64_t(0) << offset % 64;
+        }
+      }
+      
+      size_t next() {
+        while (bits == 0) {
+          if (++word >= nulls.words) {
+            return nulls.size;
+          }
+          bits = nulls.bitmap[word];
+        }
+        const size_t index = nulls.base + word * 64 + lowestBit(bits);
+        bits &= bits - 1;
+        return index;
+      }
+    
+    private:
+      const Nulls &nulls;
+      size_t word;
+      uint64_t bits;
+    };
+  
+  private:
+    size_t size;
+    size_t base;
+    size_t words;
+    std::unique_ptr<uint64_t []> bitmap;
+    std::vector<size_t> rangeCounts;
+  };
+  
+  enum class Stop {
+    //the number of entries that was asked for were parsed
+    count,
+    //an empty name or the end of the file was reached
+    end,
+    error
+  };
+  
+  //Parses at most count entries starting at begin. The name and password of
+  //each entry are given to the function
+  template <typename Function>
+  Stop parseEntries(
+    Function &&insert,
+    const std::experimental::string_view file,
+    const Nulls &nulls,
+    size_t begin,
+    const size_t count
+  ) {
+    Nulls::Cursor cursor(nulls, begin);
+    for (size_t e = 0; e != count; ++e) {
+      const size_t keyEnd = cursor.next();
+      if (keyEnd == file.size() || keyEnd == begin) return Stop::end;
+      const size_t valEnd = cursor.next();
+      if (valEnd == file.size() || valEnd == keyEnd + 1) return Stop::error;
+      
+      insert(
+        file.substr(begin, keyEnd - begin),
+        file.substr(keyEnd + 1, valEnd - keyEnd - 1)
+      );
+      begin = valEnd + 1;
+    }
+    return Stop::count;
+  }
+  
+  struct Hashed {
+    size_t hash;
+    std::experimental::string_view name;
+    std::experimental::string_view password;
+  };
+  
+  //Large numbers of entries are split into a chunk for every core. The parse
+  //function is given the index of the first entry of a chunk, the number of
+  //entries in the chunk and a function to give each entry to. The first chunk
+  //is inserted straight into the table. The entries of the other chunks are
+  //found and hashed on their own thread and then inserted in order so that the
+  //first entry with a name is kept
+  template <typename Insert, typename Parse>
+  Stop parseChunks(const size_t entries, Insert &&insert, Parse &&parse) {
+    using View = std::experimental::string_view;
+    auto insertNow = [&insert] (const View name, const View password) {
+      insert(std::hash<View>()(name), name, password);
+    };
+    const size_t chunks = std::min(parallelThreads(), entries / MIN_CHUNK_ENTRIES);
+    if (chunks <= 1) {
+      return parse(0, entries, insertNow);
+    }
+    
+    const size_t chunkEntries = entries / chunks;
+    std::vector<std::vector<Hashed>> parsed(chunks - 1);
+    std::vector<Stop> stops(chunks);
+    
+    parallelFor(chunks, [&] (const size_t c) {
+      const size_t first = c * chunkEntries;
+      const size_t count = c == chunks - 1 ? entries - first : chunkEntries;
+      if (c == 0) {
+        stops[c] = parse(first, count, insertNow);
+        return;
+      }
+      std::vector<Hashed> &chunk = parsed[c - 1];
+      chunk.reserve(count);
+      stops[c] = parse(first, count, [&chunk] (const View name, const View password) {
+        chunk.push_back({std::hash<View>()(name), name, password});
+      });
+    });
+    
+    for (size_t c = 0; c != chunks; ++c) {
+      if (c != 0) {
+        for (const Hashed &entry : parsed[c - 1]) {
+          insert(entry.hash, entry.name, entry.password);
+        }
+      }
+      if (stops[c] != Stop::count) {
+        return stops[c];
+      }
+    }
+    return Stop::count;
+  }
+}
+
+Passwords::const_iterator &Passwords::const_iterator::operator++() {
+  do {
+    ++ctrl;
+    ++slot;
+  } while (*ctrl == EMPTY || *ctrl == DELETED);
+  return *this;
+}
+
+Passwords::Passwords()
+  : decrypted(), copies(), ctrl(), slots() {}
+
+Passwords::Passwords(Passwords &&other)
+  : decrypted(), copies(), ctrl(), slots() {
+  *this = std::move(other);
+}
+
+Passwords &Passwords::operator=(Passwords &&other) {
+  //the names and passwords are on the heap so they don't move
+  decrypted = std::move(other.decrypted);
+  copies = std::move(other.copies);
+  ctrl = std::move(other.ctrl);
+  slots = std::move(other.slots);
+  capacity = other.capacity;
+  count = other.count;
+  growthLeft = other.growthLeft;
+  fileLayout = other.fileLayout;
+  other.capacity = other.count = other.growthLeft = 0;
+  return *this;
+}
+
+Passwords::const_iterator Passwords::begin() const {
+  const_iterator first = iter(0);
+  if (capacity != 0 && (ctrl[0] == EMPTY || ctrl[0] == DELETED)) {
+    ++first;
+  }
+  return first;
+}
+
+Passwords::const_iterator Passwords::end() const {
+  return iter(capacity);
+}
+
+Passwords::const_iterator Passwords::cbegin() const {
+  return begin();
+}
+
+Passwords::const_iterator Passwords::cend() const {
+  return end();
+}
+
+size_t Passwords::size() const {
+  return count;
+}
+
+bool Passwords::empty() const {
+  return count == 0;
+}
+
+Passwords::const_iterator Passwords::find(const View name) const {
+  return iter(findIndex(name, std::hash<View>()(name)));
+}
+
+void Passwords::reserve(const size_t size) {
+  size_t newCapacity = std::max(capacity, GROUP_SIZE);
+  while (maxFilled(newCapacity) < size) {
+    newCapacity *= 2;
+  }
+  if (newCapacity != capacity) {
+    rehash(newCapacity);
+  }
+}
+
+std::pair<Passwords::iterator, bool> Passwords::emplace(
+  const View name,
+  const View password
+) {
+  const size_t hash = std::hash<View>()(name);
+  const size_t index = findIndex(name, hash);
+  if (index != capacity) {
+    return {iter(index), false};
+  }
+  return {iter(insertNew(hash, copy(name), copy(password))), true};
+}
+
+void Passwords::assign(const iterator entry, const View password) {
+  //the old password stays in memory until the database is cleared
+  slots[entry.slot - slots.get()].second = copy(password);
+}
+
+Passwords::iterator Passwords::erase(const const_iterator entry) {
+  const size_t index = entry.slot - slots.get();
+  //Probing stops at a group with an empty slot. If this group has always
+  //had an empty slot then no probe has gone past it so the slot can be empty
+  const size_t group = index / GROUP_SIZE * GROUP_SIZE;
+  if (Group(ctrl.get() + group).matchEmpty()) {
+    ctrl[index] = EMPTY;
+    ++growthLeft;
+  } else {
+    ctrl[index] = DELETED;
+  }
+  --count;
+  const_iterator next = iter(index);
+  return ++next;
+}
+
+void Passwords::clear() {
+  ctrl.reset();
+  slots.reset();
+  capacity = 0;
+  count = 0;
+  growthLeft = 0;
+  decrypted.reset();
+  copies.reset();
+}
+
+Layout Passwords::layout() const {
+  return fileLayout;
+}
+
+void Passwords::setLayout(const Layout layout) {
+  fileLayout = layout;
+}
+
+Passwords Passwords::snapshot() const {
+  Passwords copy;
+  copy.decrypted = decrypted;
+  copy.copies = copies;
+  if (capacity != 0) {
+    copy.ctrl.reset(new uint8_t[capacity + 1]);
+    std::copy_n(ctrl.get(), capacity + 1, copy.ctrl.get());
+    copy.slots.reset(static_cast<Entry *>(::operator new(capacity * sizeof(Entry))));
+    for (size_t i = 0; i != capacity; ++i) {
+      if (ctrl[i] != EMPTY && ctrl[i] != DELETED) {
+        new (copy.slots.get() + i) Entry(slots[i]);
+      }
+    }
+  }
+  copy.capacity = capacity;
+  copy.count = count;
+  copy.growthLeft = growthLeft;
+  copy.fileLayout = fileLayout;
+  return copy;
+}
+
+void Passwords::FreeSlots::operator()(Entry *const slots) const {
+  ::operator delete(slots);
+}
+
+Passwords::View Passwords::copy(const View str) {
+  //elements of a deque don't move when more elements are added
+  if (!copies) {
+    copies = std::make_shared<std::deque<std::string>>();
+  }
+  copies->emplace_back(str.data(), str.size());
+  return copies->back();
+}
+
+const uint8_t *Passwords::controls() const {
+  return capacity == 0 ? &EMPTY_TABLE : ctrl.get();
+}
+
+Passwords::const_iterator Passwords::iter(const size_t index) const {
+  return {controls() + index, slots.get() + index};
+}
+
+//Returns the capacity if the name isn't in the table
+size_t Passwords::findIndex(const View name, const size_t hash) const {
+  if (capacity == 0) {
+    return capacity;
+  }
+  const uint8_t top = topBits(hash);
+  const size_t groupMask = capacity / GROUP_SIZE - 1;
+  size_t group = hash & groupMask;
+  //every group is visited when the step grows by one each time
+  for (size_t step = 1; ; ++step) {
+    const size_t first = group * GROUP_SIZE;
+    const Group candidates(ctrl.get() + first);
+    for (uint32_t bits = candidates.match(top); bits; bits &= bits - 1) {
+      const size_t index = first + lowestBit(bits);
+      if (slots[index].first == name) {
+        return index;
+      }
+    }
+    if (candidates.matchEmpty()) {
+      return capacity;
+    }
+    group = (group + step) & groupMask;
+  }
+}
+
+//The name must not be in the table
+size_t Passwords::insertNew(
+  const size_t hash,
+  const View name,
+  const View password
+) {
+  if (growthLeft == 0) {
+    //if most of the used slots are deleted then the table doesn't need to
+    //get any bigger
+    if (count < maxFilled(capacity) / 2) {
+      rehash(capacity);
+    } else {
+      rehash(std::max(capacity * 2, GROUP_SIZE));
+    }
+  }
+  
+  const size_t groupMask = capacity / GROUP_SIZE - 1;
+  size_t group = hash & groupMask;
+  uint32_t free = Group(ctrl.get() + group * GROUP_SIZE).matchFree();
+  for (size_t step = 1; free == 0; ++step) {
+    group = (group + step) & groupMask;
+    free = Group(ctrl.get() + group * GROUP_SIZE).matchFree();
+  }
+  
+  const size_t index = group * GROUP_SIZE + lowestBit(free);
+  growthLeft -= ctrl[index] == EMPTY;
+  ctrl[index] = topBits(hash);
+  new (slots.get() + index) Entry{name, password};
+  ++count;
+  return index;
+}
+
+void Passwords::tryInsert(
+  const size_t hash,
+  const View name,
+  const View password
+) {
+  if (findIndex(name, hash) == capacity) {
+    insertNew(hash, name, password);
+  }
+}
+
+void Passwords::rehash(const size_t newCapacity) {
+  std::unique_ptr<uint8_t []> oldCtrl = std::move(ctrl);
+  std::unique_ptr<Entry [], FreeSlots> oldSlots = std::move(slots);
+  const size_t oldCapacity = capacity;
+  
+  //the slots are only written when they're filled
+  ctrl.reset(new uint8_t[newCapacity + 1]);
+  std::fill(ctrl.get(), ctrl.get() + newCapacity, EMPTY);
+  ctrl[newCapacity] = SENTINEL;
+  slots.reset(static_cast<Entry *>(::operator new(newCapacity * sizeof(Entry))));
+  capacity = newCapacity;
+  growthLeft = maxFilled(newCapacity);
+  count = 0;
+  
+  for (size_t i = 0; i != oldCapacity; ++i) {
+    if (oldCtrl[i] != EMPTY && oldCtrl[i] != DELETED) {
+      const Entry &entry = oldSlots[i];
+      insertNew(std::hash<View>()(entry.first), entry.first, entry.second);
+    }
+  }
+}
+
 /*
 
-file
+legacy file
   entry
     password name
     0
     password
     0
 
+indexed file
+  magic
+  version
+  number of records
+  record
+    length of name
+    name
+    length of password
+    password
+  index entry (sorted by hash and then by offset)
+    hash of name
+    offset of record
+
 */
 
-Passwords readPasswords(std::experimental::string_view decryptedFile) {
-  Passwords passwords;
+namespace {
+  using View = std::experimental::string_view;
+  
+  //A legacy file that starts with a null character is empty
+  constexpr char INDEXED_MAGIC[] = {'\0', 'P', 'W', 'I'};
+  //The legacy layout is version 1
+  constexpr uint8_t INDEXED_VERSION = 2;
   
-  constexpr size_t npos = std::experimental::string_view::npos;
+  constexpr size_t INDEXED_HEADER_SIZE = sizeof(INDEXED_MAGIC) + 1 + sizeof(uint64_t);
+  constexpr size_t INDEX_ENTRY_SIZE = 2 * sizeof(uint64_t);
+  //The smallest record is two empty fields and its index entry
+  constexpr size_t MIN_RECORD_SIZE = 2 + INDEX_ENTRY_SIZE;
+  //Lengths are stored 7 bits at a time
+  constexpr size_t MAX_VARINT_SIZE = 10;
+  //The index is written this many entries at a time
+  constexpr size_t INDEX_BATCH_SIZE = 1024;
+  
+  bool indexedMagic(const View file) {
+    return file.substr(0, sizeof(INDEXED_MAGIC)) == View(INDEXED_MAGIC, sizeof(INDEXED_MAGIC));
+  }
+  
+  void write64(char *bytes, const uint64_t word) {
+    for (size_t i = 0; i != sizeof(uint64_t); ++i) {
+      bytes[i] = static_cast<char>(word >> (i * 8));
+    }
+  }
+  
+  uint64_t read64(const char *bytes) {
+    uint64_t word = 0;
+    for (size_t i = 0; i != sizeof(uint64_t); ++i) {
+      word |= uint64_t(uint8_t(bytes[i])) << (i * 8);
+    }
+    return word;
+  }
   
-  auto getStr = [&decryptedFile] () -> std::experimental::string_view {
-    const size_t nullChar = decryptedFile.find_first_of('\0', 0);
-    if (nullChar == npos) {
-      return {};
+  //The index is saved so the hash has to be the same on every platform.
+  //This is 64 bit FNV-1a
+  uint64_t nameHash(const View name) {
+    uint64_t hash = 0xCBF29CE484222325;
+    for (const char c : name) {
+      hash ^= uint8_t(c);
+      hash *= 0x100000001B3;
     }
-    const auto str = decryptedFile.substr(0, nullChar);
-    decryptedFile.remove_prefix(nullChar + 1);
-    return str;
+    return hash;
+  }
+  
+  //Returns the number of bytes written
+  size_t writeVarint(char *bytes, uint64_t value) {
+    size_t size = 0;
+    while (value >= 0x80) {
+      bytes[size++] = static_cast<char>(value | 0x80);
+      value >>= 7;
+    }
+    bytes[size++] = static_cast<char>(value);
+    return size;
+  }
+  
+  enum class Field {
+    complete,
+    //the end was reached before the field was
+    incomplete,
+    invalid
   };
   
-  while (true) {
-    const auto key = getStr();
-    if (key.empty()) break;
-    const auto val = getStr();
-    if (val.empty()) throw std::runtime_error("Parse failed");
+  //Moves the position past the varint
+  Field readVarint(const char *&pos, const char *end, uint64_t &value) {
+    value = 0;
+    for (size_t i = 0; i != MAX_VARINT_SIZE; ++i) {
+      if (pos + i == end) {
+        return Field::incomplete;
+      }
+      const uint8_t byte = pos[i];
+      value |= uint64_t(byte & 0x7F) << (i * 7);
+      if ((byte & 0x80) == 0) {
+        pos += i + 1;
+        return Field::complete;
+      }
+    }
+    return Field::invalid;
+  }
+  
+  //A length followed by that many bytes. Moves the position past the field
+  Field readField(const char *&pos, const char *end, View &field) {
+    const char *start = pos;
+    uint64_t size;
+    const Field length = readVarint(start, end, size);
+    if (length != Field::complete) {
+      return length;
+    }
+    if (size > uint64_t(end - start)) {
+      return Field::incomplete;
+    }
+    field = View(start, size);
+    pos = start + size;
+    return Field::complete;
+  }
+  
+  //A name followed by a password. Moves the position past the record if the
+  //whole record is there
+  Field readRecord(
+    const char *&pos,
+    const char *end,
+    View &name,
+    View &password
+  ) {
+    const char *start = pos;
+    Field field = readField(start, end, name);
+    if (field == Field::complete) {
+      field = readField(start, end, password);
+    }
+    if (field == Field::complete) {
+      pos = start;
+    }
+    return field;
+  }
+  
+  bool legacyEntry(const Passwords::Entry &entry) {
+    return !entry.first.empty() &&
+           !entry.second.empty() &&
+           entry.first.find('\0') == View::npos &&
+           entry.second.find('\0') == View::npos;
+  }
+  
+  void writeLegacy(
+    const Passwords &passwords,
+    const std::function<void (View)> &write
+  ) {
+    const View nullChar("", 1);
+    
+    const auto end = passwords.cend();
+    for (auto p = passwords.cbegin(); p != end; ++p) {
+      if (!legacyEntry(*p)) {
+        throw std::runtime_error(
+          "\"" + p->first.to_string() + "\" can't be written in the legacy layout"
+        );
+      }
+      write(p->first);
+      write(nullChar);
+      write(p->second);
+      write(nullChar);
+    }
+  }
+  
+  void writeIndexed(
+    const Passwords &passwords,
+    const std::function<void (View)> &write
+  ) {
+    char header[INDEXED_HEADER_SIZE];
+    std::copy(std::begin(INDEXED_MAGIC), std::end(INDEXED_MAGIC), header);
+    header[sizeof(INDEXED_MAGIC)] = INDEXED_VERSION;
+    write64(header + sizeof(INDEXED_MAGIC) + 1, passwords.size());
+    write(View(header, sizeof(header)));
+    
+    struct IndexEntry {
+      uint64_t hash;
+      uint64_t offset;
+    };
+    std::vector<IndexEntry> index;
+    index.reserve(passwords.size());
+    uint64_t offset = INDEXED_HEADER_SIZE;
     
-    passwords.emplace(key.to_string(), val.to_string());
+    const auto end = passwords.cend();
+    for (auto p = passwords.cbegin(); p != end; ++p) {
+      index.push_back({nameHash(p->first), offset});
+      for (const View field : {p->first, p->second}) {
+        char length[MAX_VARINT_SIZE];
+        const size_t lengthSize = writeVarint(length, field.size());
+        write(View(length, lengthSize));
+        write(field);
+        offset += lengthSize + field.size();
+      }
+    }
+    
+    std::sort(
+      index.begin(),
+      index.end(),
+      [] (const IndexEntry &a, const IndexEntry &b) {
+        return a.hash < b.hash || (a.hash == b.hash && a.offset < b.offset);
+      }
+    );
+    
+    char batch[INDEX_BATCH_SIZE * INDEX_ENTRY_SIZE];
+    for (size_t i = 0; i < index.size(); i += INDEX_BATCH_SIZE) {
+      const size_t batchSize = std::min(INDEX_BATCH_SIZE, index.size() - i);
+      for (size_t e = 0; e != batchSize; ++e) {
+        char *const bytes = batch + e * INDEX_ENTRY_SIZE;
+        write64(bytes, index[i + e].hash);
+        write64(bytes + sizeof(uint64_t), index[i + e].offset);
+      }
+      write(View(batch, batchSize * INDEX_ENTRY_SIZE));
+    }
+  }
+}
+
+Passwords readPasswords(std::string &&decryptedFile) {
+  if (indexedMagic(decryptedFile)) {
+    PasswordsReader reader;
+    reader.file() = std::move(decryptedFile);
+    reader.update();
+    return reader.finish();
+  }
+  
+  Passwords passwords;
+  passwords.fileLayout = Layout::legacy;
+  //the string is on the heap so that entries still point to it after the
+  //Passwords are moved
+  passwords.decrypted = std::make_shared<std::string>(std::move(decryptedFile));
+  const View file = *passwords.decrypted;
+  
+  //every null character is found before anything is parsed
+  const Nulls nulls(file);
+  
+  //every entry has two null characters
+  const size_t entries = nulls.count() / 2;
+  passwords.reserve(entries);
+  
+  auto insert = [&passwords] (
+    const size_t hash,
+    const View name,
+    const View password
+  ) {
+    passwords.tryInsert(hash, name, password);
+  };
+  
+  const Stop stop = parseChunks(entries, insert, [&] (
+    const size_t first,
+    const size_t count,
+    auto &&emit
+  ) {
+    const size_t begin = first == 0 ? 0 : nulls.find(first * 2 - 1) + 1;
+    //the last chunk goes to the end of the file
+    const bool last = first + count == entries;
+    return parseEntries(emit, file, nulls, begin, last ? SIZE_MAX : count);
+  });
+  if (stop == Stop::error) {
+    throw std::runtime_error("Parse failed");
   }
   
   return passwords;
 }
 
-std::string writePasswords(const Passwords &passwords) {
-  std::string decryptedFile;
+PasswordsReader::PasswordsReader()
+  : passwords(), parsing() {
+  //the string is on the heap so that entries still point to it after the
+  //Passwords are moved
+  passwords.decrypted = std::make_shared<std::string>();
+}
+
+PasswordsReader::~PasswordsReader() {
+  if (parsing.valid()) {
+    parsing.wait();
+  }
+}
+
+std::string &PasswordsReader::file() {
+  return *passwords.decrypted;
+}
+
+void PasswordsReader::update() {
+  //the pieces have to be parsed in order
+  if (parsing.valid()) {
+    parsing.get();
+  }
+  //the string is appended to while this piece is parsed so only the bytes
+  //are shared with the other thread
+  const char *const data = passwords.decrypted->data();
+  const size_t end = passwords.decrypted->size();
+  const size_t fileSize = passwords.decrypted->capacity();
+  parsing = std::async(std::launch::async, [this, data, end, fileSize] {
+    parse(data, end, fileSize);
+  });
+}
+
+Passwords PasswordsReader::finish() {
+  if (parsing.valid()) {
+    parsing.get();
+  }
+  const size_t size = passwords.decrypted->size();
+  //a file that is smaller than the header is all there is
+  if (state == State::layout) {
+    parse(passwords.decrypted->data(), size, size);
+  }
+  //a legacy file can't end with a name and the index of an indexed file has
+  //to fill the rest of the file
+  if (
+    state == State::error ||
+    state == State::password ||
+    state == State::record ||
+    (state == State::index && size - begin != records * INDEX_ENTRY_SIZE)
+  ) {
+    throw std::runtime_error("Parse failed");
+  }
+  return std::move(passwords);
+}
+
+void PasswordsReader::parse(
+  const char *data,
+  const size_t end,
+  const size_t fileSize
+) {
+  if (state == State::layout) {
+    if (end < INDEXED_HEADER_SIZE && end != fileSize) {
+      return;
+    }
+    if (!indexedMagic(View(data, end))) {
+      passwords.fileLayout = Layout::legacy;
+      state = State::name;
+    } else if (
+      end < INDEXED_HEADER_SIZE ||
+      uint8_t(data[sizeof(INDEXED_MAGIC)]) != INDEXED_VERSION
+    ) {
+      state = State::error;
+    } else {
+      passwords.fileLayout = Layout::indexed;
+      records = recordsLeft = read64(data + sizeof(INDEXED_MAGIC) + 1);
+      begin = INDEXED_HEADER_SIZE;
+      //the file hasn't been authenticated yet so the number of records might
+      //be nonsense
+      passwords.reserve(std::min<uint64_t>(records, fileSize / MIN_RECORD_SIZE));
+      state = State::record;
+    }
+  }
+  
+  if (state == State::name || state == State::password) {
+    parseNulls(data, end, fileSize);
+  } else if (state == State::record) {
+    parseRecords(data, end);
+  }
+}
+
+//Entries that started in an earlier piece are finished when their null
+//characters are found in this one. The whole entries in the piece are parsed
+//on every core
+void PasswordsReader::parseNulls(
+  const char *data,
+  const size_t end,
+  const size_t fileSize
+) {
+  if (scanned == end) {
+    return;
+  }
+  
+  const View file(data, end);
+  const Nulls nulls(file, scanned);
+  const size_t nullCount = nulls.count();
+  //the rest of the file probably has about as many entries per byte as the
+  //first piece so the table is only grown once
+  if (scanned == 0) {
+    passwords.reserve(nullCount / 2 * fileSize / end);
+  }
+  scanned = end;
+  
+  auto insert = [this] (
+    const size_t hash,
+    const View name,
+    const View password
+  ) {
+    passwords.tryInsert(hash, name, password);
+  };
+  
+  //the null characters that have been parsed
+  size_t used = 0;
+  if (state == State::password) {
+    if (nullCount == 0) {
+      return;
+    }
+    const size_t pos = nulls.find(0);
+    if (pos == nameEnd + 1) {
+      state = State::error;
+      return;
+    }
+    const View name(data + begin, nameEnd - begin);
+    insert(std::hash<View>()(name), name, View(data + nameEnd + 1, pos - nameEnd - 1));
+    begin = pos + 1;
+    state = State::name;
+    used = 1;
+  }
+  
+  const size_t entries = (nullCount - used) / 2;
+  const size_t firstNull = used;
+  const Stop stop = parseChunks(entries, insert, [&] (
+    const size_t first,
+    const size_t count,
+    auto &&emit
+  ) {
+    const size_t chunkBegin = first == 0
+                            ? begin
+                            : nulls.find(firstNull + first * 2 - 1) + 1;
+    return parseEntries(emit, file, nulls, chunkBegin, count);
+  });
+  if (stop == Stop::end) {
+    state = State::end;
+    return;
+  } else if (stop == Stop::error) {
+    state = State::error;
+    return;
+  }
+  
+  used += entries * 2;
+  if (entries != 0) {
+    begin = nulls.find(used - 1) + 1;
+  }
+  //the name of the next entry ends in this piece
+  if (used != nullCount) {
+    const size_t pos = nulls.find(used);
+    if (pos == begin) {
+      state = State::end;
+      return;
+    }
+    nameEnd = pos;
+    state = State::password;
+  }
+}
+
+//A record that was cut off at the end of the last piece is parsed again from
+//the start. The records in the piece are found one after another and then
+//split into chunks that are parsed on every core
+void PasswordsReader::parseRecords(const char *data, const size_t end) {
+  //the offset of every MIN_CHUNK_ENTRIES-th record so that a chunk can start
+  //near its first record
+  std::vector<size_t> marks;
+  size_t complete = 0;
+  const char *pos = data + begin;
+  Field field = Field::complete;
+  for (; complete != recordsLeft; ++complete) {
+    if (complete % MIN_CHUNK_ENTRIES == 0) {
+      marks.push_back(pos - data);
+    }
+    View name;
+    View password;
+    field = readRecord(pos, data + end, name, password);
+    if (field != Field::complete) {
+      break;
+    }
+  }
+  
+  auto insert = [this] (
+    const size_t hash,
+    const View name,
+    const View password
+  ) {
+    passwords.tryInsert(hash, name, password);
+  };
+  
+  parseChunks(complete, insert, [&] (
+    const size_t first,
+    const size_t count,
+    auto &&emit
+  ) {
+    if (count == 0) {
+      return Stop::count;
+    }
+    size_t record = first / MIN_CHUNK_ENTRIES * MIN_CHUNK_ENTRIES;
+    const char *recordPos = data + marks[first / MIN_CHUNK_ENTRIES];
+    for (; record != first + count; ++record) {
+      View name;
+      View password;
+      readRecord(recordPos, data + end, name, password);
+      if (record >= first) {
+        emit(name, password);
+      }
+    }
+    return Stop::count;
+  });
   
-  const auto end = passwords.cend();
-  for (auto p = passwords.cbegin(); p != end; ++p) {
-    decryptedFile.append(p->first);
-    decryptedFile.push_back('\0');
-    decryptedFile.append(p->second);
-    decryptedFile.push_back('\0');
+  begin = pos - data;
+  recordsLeft -= complete;
+  if (field == Field::invalid) {
+    state = State::error;
+  } else if (recordsLeft == 0) {
+    state = State::index;
+  }
+}
+
+void writePasswords(
+  const Passwords &passwords,
+  const std::function<void (std::experimental::string_view)> &write
+) {
+  if (passwords.layout() == Layout::indexed) {
+    writeIndexed(passwords, write);
+  } else {
+    writeLegacy(passwords, write);
+  }
+}
+
+Passwords::const_iterator findNonLegacy(const Passwords &passwords) {
+  return std::find_if(
+    passwords.cbegin(),
+    passwords.cend(),
+    [] (const Passwords::Entry &entry) {
+      return !legacyEntry(entry);
+    }
+  );
+}
+
+std::experimental::optional<std::string> findPassword(
+  const size_t size,
+  const std::function<std::experimental::string_view (size_t, size_t)> &read,
+  const std::experimental::string_view name
+) {
+  if (size < INDEXED_HEADER_SIZE) {
+    throw std::runtime_error("The file doesn't have an index");
+  }
+  const View header = read(0, INDEXED_HEADER_SIZE);
+  if (
+    !indexedMagic(header) ||
+    uint8_t(header[sizeof(INDEXED_MAGIC)]) != INDEXED_VERSION
+  ) {
+    throw std::runtime_error("The file doesn't have an index");
+  }
+  const uint64_t records = read64(header.data() + sizeof(INDEXED_MAGIC) + 1);
+  if (records > (size - INDEXED_HEADER_SIZE) / MIN_RECORD_SIZE) {
+    throw std::runtime_error("Parse failed");
+  }
+  const size_t indexBegin = size - records * INDEX_ENTRY_SIZE;
+  
+  auto indexEntry = [&] (const size_t i) {
+    return read(indexBegin + i * INDEX_ENTRY_SIZE, INDEX_ENTRY_SIZE);
+  };
+  
+  //binary search for the first entry with the hash
+  const uint64_t hash = nameHash(name);
+  size_t first = 0;
+  size_t last = records;
+  while (first != last) {
+    const size_t middle = first + (last - first) / 2;
+    if (read64(indexEntry(middle).data()) < hash) {
+      first = middle + 1;
+    } else {
+      last = middle;
+    }
   }
   
-  return decryptedFile;
+  //Reads a field of a record and moves the offset past it
+  auto readRecordField = [&] (size_t &offset) {
+    if (offset >= indexBegin) {
+      throw std::runtime_error("Parse failed");
+    }
+    const View lengthBytes = read(
+      offset, std::min(MAX_VARINT_SIZE, indexBegin - offset)
+    );
+    const char *pos = lengthBytes.data();
+    uint64_t length;
+    const Field field = readVarint(
+      pos, lengthBytes.data() + lengthBytes.size(), length
+    );
+    offset += pos - lengthBytes.data();
+    if (field != Field::complete || length > indexBegin - offset) {
+      throw std::runtime_error("Parse failed");
+    }
+    const View bytes = read(offset, length);
+    offset += length;
+    return bytes;
+  };
+  
+  //names with the same hash are compared until one matches
+  for (; first != records; ++first) {
+    const View entry = indexEntry(first);
+    if (read64(entry.data()) != hash) {
+      break;
+    }
+    size_t offset = read64(entry.data() + sizeof(uint64_t));
+    if (readRecordField(offset) == name) {
+      return readRecordField(offset).to_string();
+    }
+  }
+  return std::experimental::nullopt;
 }
@@ -9,12 +9,227 @@
 #ifndef parse_hpp
 #define parse_hpp
 
-#include <unordered_map>
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <iterator>
+#include <functional>
+#include <experimental/optional>
 #include <experimental/string_view>
 
-using Passwords = std::unordered_map<std::string, std::string>;
+//How the entries are laid out in the decrypted file
+enum class Layout {
+  //Each name and password is followed by a null character. Names and
+  //passwords can't be empty or contain null characters
+  legacy,
+  //Each name and password is preceded by its length. The records are followed
+  //by an index that is sorted by the hash of the names
+  indexed
+};
 
-Passwords readPasswords(std::experimental::string_view);
-std::string writePasswords(const Passwords &);
+//The names and passwords in a database. Entries point into the decrypted file
+//so opening a database doesn't allocate for every entry. Entries that are
+//created or changed are copied into storage owned by the Passwords.
+//
+//Entries are stored in a flat open addressing table. Each entry has a control
+//byte that holds a few bits of the hash of its name so that a group of
+//entries can be checked at once. Adding an entry may move every entry so
+//iterators are only valid until the next call to emplace or reserve.
+//
+//New databases are written in the indexed layout. Opened databases are
+//written in the layout they were read in until the layout is changed
+class Passwords {
+  using View = std::experimental::string_view;
+
+public:
+  struct Entry {
+    View first;
+    View second;
+  };
+  
+  class const_iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Entry;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Entry *;
+    using reference = const Entry &;
+    
+    const_iterator() = default;
+    
+    reference operator*() const {
+      return *slot;
+    }
+    pointer operator->() const {
+      return slot;
+    }
+    
+    const_iterator &operator++();
+    const_iterator operator++(int) {
+      const const_iterator copy = *this;
+      ++*this;
+      return copy;
+    }
+    
+    bool operator==(const const_iterator other) const {
+      return slot == other.slot;
+    }
+    bool operator!=(const const_iterator other) const {
+      return slot != other.slot;
+    }
+  
+  private:
+    friend class Passwords;
+    
+    const_iterator(const uint8_t *ctrl, const Entry *slot)
+      : ctrl(ctrl), slot(slot) {}
+    
+    const uint8_t *ctrl = nullptr;
+    const Entry *slot = nullptr;
+  };
+  
+  //entries are changed with assign
+  using iterator = const_iterator;
+  
+  Passwords();
+  Passwords(const Passwords &) = delete;
+  Passwords(Passwords &&);
+  
+  Passwords &operator=(const Passwords &) = delete;
+  Passwords &operator=(Passwords &&);
+  
+  const_iterator begin() const;
+  const_iterator end() const;
+  const_iterator cbegin() const;
+  const_iterator cend() const;
+  
+  size_t size() const;
+  bool empty() const;
+  
+  const_iterator find(View) const;
+  
+  void reserve(size_t);
+  //The name and password are copied
+  std::pair<iterator, bool> emplace(View, View);
+  //The password is copied
+  void assign(iterator, View);
+  iterator erase(const_iterator);
+  void clear();
+  
+  Layout layout() const;
+  void setLayout(Layout);
+  
+  //A copy of the table that shares the names and passwords with this one.
+  //Changing either table doesn't change the other. The names and passwords
+  //are kept alive until both tables are gone
+  Passwords snapshot() const;
+
+private:
+  struct FreeSlots {
+    void operator()(Entry *) const;
+  };
+  
+  //shared with snapshots
+  std::shared_ptr<std::string> decrypted;
+  std::shared_ptr<std::deque<std::string>> copies;
+  //a control byte for every slot followed by a sentinel
+  std::unique_ptr<uint8_t []> ctrl;
+  std::unique_ptr<Entry [], FreeSlots> slots;
+  size_t capacity = 0;
+  size_t count = 0;
+  //the number of empty slots that can be filled before the table grows
+  size_t growthLeft = 0;
+  Layout fileLayout = Layout::indexed;
+  
+  View copy(View);
+  const uint8_t *controls() const;
+  const_iterator iter(size_t) const;
+  size_t findIndex(View, size_t) const;
+  size_t insertNew(size_t, View, View);
+  //The name and password are not copied
+  void tryInsert(size_t, View, View);
+  void rehash(size_t);
+  
+  friend class PasswordsReader;
+  friend Passwords readPasswords(std::string &&);
+};
+
+//Parses a file while it's being decrypted. The entries of each piece are
+//parsed on another thread while the next piece is decrypted. Errors aren't
+//reported until the end because the file might not be authentic
+class PasswordsReader {
+public:
+  PasswordsReader();
+  PasswordsReader(const PasswordsReader &) = delete;
+  ~PasswordsReader();
+  
+  PasswordsReader &operator=(const PasswordsReader &) = delete;
+  
+  //The decrypted file is appended to this string. It must have room for the
+  //whole file before the first update so that it's never reallocated. The
+  //number of entries is guessed from the first piece and the capacity
+  std::string &file();
+  //Parses the entries that have been appended since the last update
+  void update();
+  //The Passwords take ownership of the file. Throws if the file couldn't be
+  //parsed
+  Passwords finish();
+
+private:
+  enum class State {
+    //the header hasn't been decrypted yet
+    layout,
+    //legacy layout
+    name,
+    password,
+    //an empty name was reached so the rest of the file is ignored
+    end,
+    //indexed layout
+    record,
+    index,
+    error
+  };
+  
+  Passwords passwords;
+  std::future<void> parsing;
+  State state = State::layout;
+  //the number of bytes that have been searched for null characters
+  size_t scanned = 0;
+  //the beginning of the entry that is being parsed
+  size_t begin = 0;
+  //the null character after the name of the entry that is being parsed
+  size_t nameEnd = 0;
+  //the number of records in an indexed file
+  size_t records = 0;
+  size_t recordsLeft = 0;
+  
+  void parse(const char *, size_t, size_t);
+  void parseNulls(const char *, size_t, size_t);
+  void parseRecords(const char *, size_t);
+};
+
+//The Passwords take ownership of the decrypted file
+Passwords readPasswords(std::string &&);
+//The file is given to the function a piece at a time in the layout of the
+//Passwords. Throws if an entry can't be written in the legacy layout
+void writePasswords(
+  const Passwords &,
+  const std::function<void (std::experimental::string_view)> &
+);
+//Returns the first entry that can't be written in the legacy layout
+Passwords::const_iterator findNonLegacy(const Passwords &);
+
+//Finds a password in a file with the indexed layout by searching the index
+//so that only a few small ranges of the file are read. The function is given
+//an offset and a size and returns that range of the file. The range only has
+//to last until the next call. The file is the given size. Returns nullopt if
+//there is no password with the name
+std::experimental::optional<std::string> findPassword(
+  size_t,
+  const std::function<std::experimental::string_view (size_t, size_t)> &,
+  std::experimental::string_view
+);
 
 #endif
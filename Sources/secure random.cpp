@@ -0,0 +1,118 @@
+//
+//  secure random.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 16/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "secure random.hpp"
+
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SECURE_RANDOM_GETENTROPY
+#include <unistd.h>
+#include <sys/random.h>
+#endif
+
+namespace {
+  uint32_t loadWord(const uint8_t *bytes) {
+    return uint32_t(bytes[0])
+         | uint32_t(bytes[1]) << 8
+         | uint32_t(bytes[2]) << 16
+         | uint32_t(bytes[3]) << 24;
+  }
+  
+  void loadKey(ChaChaKey &key, const uint8_t *bytes) {
+    for (size_t i = 0; i != key.size(); ++i) {
+      key[i] = loadWord(bytes + i * sizeof(uint32_t));
+    }
+  }
+}
+
+SecureRandom::SecureRandom()
+  : key() {
+  uint8_t seed[sizeof(ChaChaKey)];
+  #ifdef SECURE_RANDOM_GETENTROPY
+  if (::getentropy(seed, sizeof(seed)) != 0) {
+    throw std::runtime_error("Failed to seed the random number generator");
+  }
+  #else
+  std::random_device device;
+  for (size_t i = 0; i != sizeof(seed); ++i) {
+    seed[i] = static_cast<uint8_t>(device());
+  }
+  #endif
+  loadKey(key, seed);
+  std::fill(std::begin(seed), std::end(seed), 0);
+}
+
+void SecureRandom::fill(uint8_t *bytes, size_t size) {
+  while (size != 0) {
+    if (used == BATCH_SIZE) {
+      refill();
+    }
+    const size_t copied = std::min(size, BATCH_SIZE - used);
+    std::copy(batch + used, batch + used + copied, bytes);
+    //bytes are erased once they are handed out
+    std::fill(batch + used, batch + used + copied, 0);
+    used += copied;
+    bytes += copied;
+    size -= copied;
+  }
+}
+
+uint8_t SecureRandom::byte() {
+  if (used == BATCH_SIZE) {
+    refill();
+  }
+  const uint8_t b = batch[used];
+  batch[used++] = 0;
+  return b;
+}
+
+uint32_t SecureRandom::word() {
+  uint8_t bytes[sizeof(uint32_t)];
+  fill(bytes, sizeof(bytes));
+  return loadWord(bytes);
+}
+
+uint32_t SecureRandom::below(const uint32_t bound) {
+  if (bound == 0) {
+    throw std::runtime_error("Random number bound must be greater than zero");
+  }
+  //small bounds only use one byte per attempt
+  if (bound <= 256) {
+    const uint32_t limit = 256 - 256 % bound;
+    while (true) {
+      const uint32_t b = byte();
+      if (b < limit) {
+        return b % bound;
+      }
+    }
+  }
+  //the limit is the largest multiple of the bound that fits in 2^32
+  const uint64_t limit = (uint64_t(1) << 32) - (uint64_t(1) << 32) % bound;
+  while (true) {
+    const uint32_t w = word();
+    if (w < limit) {
+      return w % bound;
+    }
+  }
+}
+
+void SecureRandom::refill() {
+  //every batch has its own key so the nonce and counter can start at zero
+  chacha20Blocks(key, 0, 0, batch, BATCH_BLOCKS);
+  loadKey(key, batch);
+  std::fill(batch, batch + sizeof(ChaChaKey), 0);
+  used = sizeof(ChaChaKey);
+}
+
+SecureRandom &secureRandom() {
+  thread_local SecureRandom gen;
+  return gen;
+}
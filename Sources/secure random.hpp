@@ -0,0 +1,44 @@
+//
+//  secure random.hpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 16/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#ifndef secure_random_hpp
+#define secure_random_hpp
+
+#include <cstdint>
+#include <cstddef>
+#include "chacha20.hpp"
+
+//A ChaCha20 keystream seeded from the operating system. The keystream is
+//generated a few kilobytes at a time. The start of each batch becomes the key
+//for the next batch so bytes that have been handed out can't be recomputed
+class SecureRandom {
+public:
+  SecureRandom();
+  
+  void fill(uint8_t *, size_t);
+  uint8_t byte();
+  uint32_t word();
+  //A uniformly distributed number in [0, bound). Numbers that would make some
+  //results more likely than others are rejected
+  uint32_t below(uint32_t);
+
+private:
+  static constexpr size_t BATCH_BLOCKS = 64;
+  static constexpr size_t BATCH_SIZE = BATCH_BLOCKS * CHACHA_BLOCK_SIZE;
+  
+  ChaChaKey key;
+  uint8_t batch[BATCH_SIZE];
+  size_t used = BATCH_SIZE;
+  
+  void refill();
+};
+
+//The generator for the calling thread
+SecureRandom &secureRandom();
+
+#endif
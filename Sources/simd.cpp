@@ -0,0 +1,298 @@
+//
+//  simd.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 12/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "simd.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+  //8 bytes at a time without any special instructions
+  void xorScalar(
+    char *dst,
+    const char *src,
+    const uint8_t *keystream,
+    size_t size
+  ) {
+    while (size >= sizeof(uint64_t)) {
+      uint64_t d, k;
+      std::memcpy(&d, src, sizeof(uint64_t));
+      std::memcpy(&k, keystream, sizeof(uint64_t));
+      d ^= k;
+      std::memcpy(dst, &d, sizeof(uint64_t));
+      dst += sizeof(uint64_t);
+      src += sizeof(uint64_t);
+      keystream += sizeof(uint64_t);
+      size -= sizeof(uint64_t);
+    }
+    for (size_t i = 0; i != size; ++i) {
+      dst[i] = src[i] ^ keystream[i];
+    }
+  }
+  
+  #ifdef SIMD_X86
+  
+  __attribute__((target("sse2")))
+  void xorSSE2(
+    char *dst,
+    const char *src,
+    const uint8_t *keystream,
+    size_t size
+  ) {
+    while (size >= sizeof(__m128i)) {
+      const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+      const __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keystream));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_xor_si128(d, k));
+      dst += sizeof(__m128i);
+      src += sizeof(__m128i);
+      keystream += sizeof(__m128i);
+      size -= sizeof(__m128i);
+    }
+    xorScalar(dst, src, keystream, size);
+  }
+  
+  __attribute__((target("avx2")))
+  void xorAVX2(
+    char *dst,
+    const char *src,
+    const uint8_t *keystream,
+    size_t size
+  ) {
+    while (size >= sizeof(__m256i)) {
+      const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+      const __m256i k = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keystream));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_xor_si256(d, k));
+      dst += sizeof(__m256i);
+      src += sizeof(__m256i);
+      keystream += sizeof(__m256i);
+      size -= sizeof(__m256i);
+    }
+    xorSSE2(dst, src, keystream, size);
+  }
+  
+  __attribute__((target("avx512f")))
+  void xorAVX512(
+    char *dst,
+    const char *src,
+    const uint8_t *keystream,
+    size_t size
+  ) {
+    while (size >= sizeof(__m512i)) {
+      const __m512i d = _mm512_loadu_si512(src);
+      const __m512i k = _mm512_loadu_si512(keystream);
+      _mm512_storeu_si512(dst, _mm512_xor_si512(d, k));
+      dst += sizeof(__m512i);
+      src += sizeof(__m512i);
+      keystream += sizeof(__m512i);
+      size -= sizeof(__m512i);
+    }
+    xorAVX2(dst, src, keystream, size);
+  }
+  
+  #endif
+  
+  using XorFunction = void (*)(char *, const char *, const uint8_t *, size_t);
+  
+  XorFunction chooseXorKernel() {
+    #ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+      return xorAVX512;
+    } else if (__builtin_cpu_supports("avx2")) {
+      return xorAVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+      return xorSSE2;
+    }
+    #endif
+    return xorScalar;
+  }
+  
+  const XorFunction xorKernel = chooseXorKernel();
+  
+  constexpr size_t BITMAP_BLOCK = 64;
+  
+  //Up to 64 bytes at a time
+  uint64_t blockBitmap(const char *src, const size_t size, const char byte) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i != size; ++i) {
+      bits |= uint64_t(src[i] == byte) << i;
+    }
+    return bits;
+  }
+  
+  size_t bitmapScalar(
+    uint64_t *bitmap,
+    const char *src,
+    const size_t size,
+    const char byte
+  ) {
+    size_t count = 0;
+    for (size_t i = 0; i < size; i += BITMAP_BLOCK) {
+      const size_t blockSize = std::min(size - i, BITMAP_BLOCK);
+      uint64_t bits = blockBitmap(src + i, blockSize, byte);
+      bitmap[i / BITMAP_BLOCK] = bits;
+      while (bits) {
+        bits &= bits - 1;
+        ++count;
+      }
+    }
+    return count;
+  }
+  
+  #ifdef SIMD_X86
+  
+  __attribute__((target("sse2")))
+  size_t bitmapSSE2(
+    uint64_t *bitmap,
+    const char *src,
+    const size_t size,
+    const char byte
+  ) {
+    const __m128i needle = _mm_set1_epi8(byte);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + BITMAP_BLOCK <= size; i += BITMAP_BLOCK) {
+      uint64_t bits = 0;
+      for (size_t v = 0; v != BITMAP_BLOCK / sizeof(__m128i); ++v) {
+        const __m128i s = _mm_loadu_si128(
+          reinterpret_cast<const __m128i *>(src + i + v * sizeof(__m128i))
+        );
+        const uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(s, needle));
+        bits |= uint64_t(mask) << (v * sizeof(__m128i));
+      }
+      bitmap[i / BITMAP_BLOCK] = bits;
+      count += __builtin_popcountll(bits);
+    }
+    return count + bitmapScalar(bitmap + i / BITMAP_BLOCK, src + i, size - i, byte);
+  }
+  
+  __attribute__((target("avx2")))
+  size_t bitmapAVX2(
+    uint64_t *bitmap,
+    const char *src,
+    const size_t size,
+    const char byte
+  ) {
+    const __m256i needle = _mm256_set1_epi8(byte);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + BITMAP_BLOCK <= size; i += BITMAP_BLOCK) {
+      const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+      const __m256i hi = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(src + i + sizeof(__m256i))
+      );
+      const uint32_t loMask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, needle));
+      const uint32_t hiMask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, needle));
+      const uint64_t bits = uint64_t(loMask) | uint64_t(hiMask) << 32;
+      bitmap[i / BITMAP_BLOCK] = bits;
+      count += __builtin_popcountll(bits);
+    }
+    return count + bitmapScalar(bitmap + i / BITMAP_BLOCK, src + i, size - i, byte);
+  }
+  
+  #endif
+  
+  using BitmapFunction = size_t (*)(uint64_t *, const char *, size_t, char);
+  
+  BitmapFunction chooseBitmapKernel() {
+    #ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return bitmapAVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+      return bitmapSSE2;
+    }
+    #endif
+    return bitmapScalar;
+  }
+  
+  const BitmapFunction bitmapKernel = chooseBitmapKernel();
+}
+
+void xorBytes(
+  char *dst,
+  const char *src,
+  const uint8_t *keystream,
+  const size_t size
+) {
+  xorKernel(dst, src, keystream, size);
+}
+
+size_t byteBitmap(
+  uint64_t *bitmap,
+  const char *src,
+  const size_t size,
+  const char byte
+) {
+  return bitmapKernel(bitmap, src, size, byte);
+}
+
+bool kernelSupported(const SimdKernel kernel) {
+  #ifdef SIMD_X86
+  __builtin_cpu_init();
+  switch (kernel) {
+    case SimdKernel::scalar:
+      return true;
+    case SimdKernel::sse2:
+      return __builtin_cpu_supports("sse2");
+    case SimdKernel::avx2:
+      return __builtin_cpu_supports("avx2");
+    case SimdKernel::avx512:
+      return __builtin_cpu_supports("avx512f");
+  }
+  return false;
+  #else
+  return kernel == SimdKernel::scalar;
+  #endif
+}
+
+void xorBytes(
+  const SimdKernel kernel,
+  char *dst,
+  const char *src,
+  const uint8_t *keystream,
+  const size_t size
+) {
+  switch (kernel) {
+    #ifdef SIMD_X86
+    case SimdKernel::sse2:
+      return xorSSE2(dst, src, keystream, size);
+    case SimdKernel::avx2:
+      return xorAVX2(dst, src, keystream, size);
+    case SimdKernel::avx512:
+      return xorAVX512(dst, src, keystream, size);
+    #endif
+    default:
+      return xorScalar(dst, src, keystream, size);
+  }
+}
+
+size_t byteBitmap(
+  const SimdKernel kernel,
+  uint64_t *bitmap,
+  const char *src,
+  const size_t size,
+  const char byte
+) {
+  switch (kernel) {
+    #ifdef SIMD_X86
+    case SimdKernel::sse2:
+      return bitmapSSE2(bitmap, src, size, byte);
+    case SimdKernel::avx2:
+    case SimdKernel::avx512:
+      return bitmapAVX2(bitmap, src, size, byte);
+    #endif
+    default:
+      return bitmapScalar(bitmap, src, size, byte);
+  }
+}
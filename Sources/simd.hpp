@@ -0,0 +1,40 @@
+//
+//  simd.hpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 12/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#ifndef simd_hpp
+#define simd_hpp
+
+#include <cstdint>
+#include <cstddef>
+
+//XORs the source with the keystream and writes it to the destination. The
+//source and destination may be the same. The widest kernel that the CPU
+//supports is chosen when the program starts.
+void xorBytes(char *, const char *, const uint8_t *, size_t);
+
+//Sets a bit in the bitmap for every byte of the source that is equal to the
+//given byte. Byte i is bit i % 64 of word i / 64 so the bitmap needs a word
+//for every 64 bytes (rounded up). Returns the number of bits that were set.
+size_t byteBitmap(uint64_t *, const char *, size_t, char);
+
+//The instruction sets that there are kernels for
+enum class SimdKernel {
+  scalar,
+  sse2,
+  avx2,
+  avx512
+};
+
+//Whether the CPU (and the compiler) supports the kernel
+bool kernelSupported(SimdKernel);
+//The same as above but with the given kernel instead of the widest one. The
+//kernel must be supported. byteBitmap uses the AVX2 kernel for AVX-512
+void xorBytes(SimdKernel, char *, const char *, const uint8_t *, size_t);
+size_t byteBitmap(SimdKernel, uint64_t *, const char *, size_t, char);
+
+#endif
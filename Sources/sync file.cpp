@@ -0,0 +1,71 @@
+//
+//  sync file.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 20/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "sync file.hpp"
+
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SYNC_FILE_POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+  #ifdef SYNC_FILE_POSIX
+  bool syncDescriptor(const int fd) {
+    #ifdef __APPLE__
+    //fsync only hands the data to the drive, which might keep it in its cache
+    if (::fcntl(fd, F_FULLFSYNC) == 0) {
+      return true;
+    }
+    #endif
+    return ::fsync(fd) == 0;
+  }
+  
+  //The directory has to be synced for a rename to survive a crash
+  void syncDirectory(const char *path) {
+    std::string dir = path;
+    const size_t slash = dir.find_last_of('/');
+    if (slash == std::string::npos) {
+      dir = ".";
+    } else {
+      dir.resize(slash == 0 ? 1 : slash);
+    }
+    const int fd = ::open(dir.c_str(), O_RDONLY);
+    if (fd == -1) {
+      return;
+    }
+    //the file has already been replaced so there's nothing to undo if this
+    //fails
+    syncDescriptor(fd);
+    ::close(fd);
+  }
+  #endif
+}
+
+bool syncFile(std::FILE *file) {
+  if (std::fflush(file) != 0) {
+    return false;
+  }
+  #ifdef SYNC_FILE_POSIX
+  return syncDescriptor(::fileno(file));
+  #else
+  return true;
+  #endif
+}
+
+bool replaceFile(const char *from, const char *to) {
+  if (std::rename(from, to) != 0) {
+    return false;
+  }
+  #ifdef SYNC_FILE_POSIX
+  syncDirectory(to);
+  #endif
+  return true;
+}
@@ -0,0 +1,24 @@
+//
+//  sync file.hpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 20/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#ifndef sync_file_hpp
+#define sync_file_hpp
+
+#include <cstdio>
+
+//Writes the buffered data of the file and waits until the storage device has
+//it. Returns false if either failed. Only the buffer is flushed on platforms
+//that aren't supported
+bool syncFile(std::FILE *);
+
+//Renames the first file over the second in a single step and waits until the
+//change to the directory is on the storage device. Returns false if the file
+//couldn't be renamed
+bool replaceFile(const char *, const char *);
+
+#endif
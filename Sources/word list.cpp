@@ -0,0 +1,195 @@
+//
+//  word list.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 17/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "word list.hpp"
+
+#include <memory>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <sys/stat.h>
+
+#if defined(__APPLE__)
+#include <mach-o/dyld.h>
+#elif defined(__unix__)
+#include <unistd.h>
+#endif
+
+namespace {
+  using File = std::unique_ptr<std::FILE, decltype(&std::fclose)>;
+  
+  /*
+  
+  index
+    magic
+    size of the list
+    modification time of the list
+    number of words
+    begin and end of each word
+  
+  The index is a cache for this machine so it's in native byte order
+  
+  */
+  
+  constexpr char INDEX_MAGIC[8] = {'P', 'M', 'A', 'N', 'W', 'I', 'D', 'X'};
+  
+  struct IndexHeader {
+    char magic[sizeof(INDEX_MAGIC)];
+    uint64_t listSize;
+    int64_t listTime;
+    uint64_t count;
+  };
+  
+  static_assert(
+    sizeof(IndexHeader) % alignof(WordList::Word) == 0,
+    "Words in a mapped index must be aligned"
+  );
+  
+  MappedFile mapList(const std::string &path) {
+    auto list = MappedFile::map(path.c_str(), MappedFile::Access::random);
+    if (!list) {
+      throw std::runtime_error("Failed to open word list \"" + path + "\"");
+    }
+    if (list->size() > UINT32_MAX) {
+      throw std::runtime_error("Word list \"" + path + "\" is too big");
+    }
+    return std::move(*list);
+  }
+  
+  int64_t modificationTime(const std::string &path) {
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0) {
+      return 0;
+    }
+    return static_cast<int64_t>(info.st_mtime);
+  }
+  
+  //Diceware lists number each word so anything before a tab is skipped.
+  //Blank lines are skipped too
+  std::vector<WordList::Word> buildIndex(const char *list, const size_t size) {
+    std::vector<WordList::Word> words;
+    size_t lineBegin = 0;
+    while (lineBegin < size) {
+      const void *newline = std::memchr(list + lineBegin, '\n', size - lineBegin);
+      const size_t lineEnd = newline
+        ? static_cast<const char *>(newline) - list
+        : size;
+      
+      size_t begin = lineBegin;
+      size_t end = lineEnd;
+      for (size_t i = lineBegin; i != lineEnd; ++i) {
+        if (list[i] == '\t') {
+          begin = i + 1;
+        }
+      }
+      while (end != begin && (list[end - 1] == '\r' || list[end - 1] == ' ')) {
+        --end;
+      }
+      if (begin != end) {
+        words.push_back({
+          static_cast<uint32_t>(begin), static_cast<uint32_t>(end)
+        });
+      }
+      
+      lineBegin = lineEnd + 1;
+    }
+    return words;
+  }
+  
+  //The index is only a cache so failing to write it isn't an error
+  void writeIndex(
+    const std::string &path,
+    const IndexHeader &header,
+    const std::vector<WordList::Word> &words
+  ) {
+    File file(std::fopen(path.c_str(), "wb"), &std::fclose);
+    if (!file) {
+      return;
+    }
+    const bool written =
+      std::fwrite(&header, sizeof(header), 1, file.get()) == 1 &&
+      std::fwrite(
+        words.data(), sizeof(WordList::Word), words.size(), file.get()
+      ) == words.size();
+    file.reset();
+    if (!written) {
+      std::remove(path.c_str());
+    }
+  }
+}
+
+WordList::WordList(const std::string &path)
+  : list(mapList(path)), indexFile(), builtIndex() {
+  IndexHeader header;
+  std::copy(std::begin(INDEX_MAGIC), std::end(INDEX_MAGIC), header.magic);
+  header.listSize = list.size();
+  header.listTime = modificationTime(path);
+  
+  const std::string indexPath = path + ".index";
+  if (auto mapped = MappedFile::map(indexPath.c_str(), MappedFile::Access::random)) {
+    indexFile.emplace(std::move(*mapped));
+  }
+  if (indexFile && indexFile->size() >= sizeof(IndexHeader)) {
+    IndexHeader cached;
+    std::memcpy(&cached, indexFile->data(), sizeof(cached));
+    const bool valid =
+      std::equal(std::begin(INDEX_MAGIC), std::end(INDEX_MAGIC), cached.magic) &&
+      cached.listSize == header.listSize &&
+      cached.listTime == header.listTime &&
+      indexFile->size() == sizeof(IndexHeader) + cached.count * sizeof(Word);
+    if (valid) {
+      words = reinterpret_cast<const Word *>(indexFile->data() + sizeof(IndexHeader));
+      count = cached.count;
+      return;
+    }
+  }
+  indexFile = std::experimental::nullopt;
+  
+  builtIndex = buildIndex(list.data(), list.size());
+  header.count = builtIndex.size();
+  writeIndex(indexPath, header, builtIndex);
+  words = builtIndex.data();
+  count = builtIndex.size();
+}
+
+size_t WordList::size() const {
+  return count;
+}
+
+std::experimental::string_view WordList::operator[](const size_t i) const {
+  //the index might have been changed since it was checked
+  const Word word = words[i];
+  if (word.begin > word.end || word.end > list.size()) {
+    throw std::runtime_error("Word list index is corrupt");
+  }
+  return {list.data() + word.begin, word.end - word.begin};
+}
+
+std::string defaultWordListPath() {
+  std::string executable;
+  #if defined(__APPLE__)
+  char path[4096];
+  uint32_t size = sizeof(path);
+  if (_NSGetExecutablePath(path, &size) == 0) {
+    executable = path;
+  }
+  #elif defined(__unix__)
+  char path[4096];
+  const ssize_t size = ::readlink("/proc/self/exe", path, sizeof(path));
+  if (size > 0 && size_t(size) < sizeof(path)) {
+    executable.assign(path, size);
+  }
+  #endif
+  
+  //fall back to the working directory
+  const size_t slash = executable.find_last_of("/\\");
+  if (slash == std::string::npos) {
+    return "words.txt";
+  }
+  return executable.substr(0, slash + 1) + "words.txt";
+}
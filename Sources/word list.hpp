@@ -0,0 +1,50 @@
+//
+//  word list.hpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 17/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#ifndef word_list_hpp
+#define word_list_hpp
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "mapped file.hpp"
+#include <experimental/optional>
+#include <experimental/string_view>
+
+//A list of words with one word on each line. The list is mapped into memory
+//and the position of every word is cached in an index file next to the list
+//so picking a word doesn't need to read the list
+class WordList {
+public:
+  //The index is built and saved if it's missing or older than the list
+  explicit WordList(const std::string &);
+  WordList(const WordList &) = delete;
+  
+  WordList &operator=(const WordList &) = delete;
+  
+  size_t size() const;
+  std::experimental::string_view operator[](size_t) const;
+  
+  struct Word {
+    uint32_t begin;
+    uint32_t end;
+  };
+
+private:
+  MappedFile list;
+  std::experimental::optional<MappedFile> indexFile;
+  //used when the index had to be built
+  std::vector<Word> builtIndex;
+  const Word *words = nullptr;
+  size_t count = 0;
+};
+
+//The list of words next to the executable
+std::string defaultWordListPath();
+
+#endif
@@ -0,0 +1,204 @@
+//
+//  encrypt.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 21/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "../Sources/encrypt.hpp"
+
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+//Files with chunks are written and read back with and without compression.
+//The sizes are chosen so that the file ends on either side of a chunk
+//boundary and of the boundary between the buffers of the writer. A byte of a
+//chunk is flipped and only that chunk has to be reported as modified
+
+namespace {
+  using View = std::experimental::string_view;
+
+  const char PATH[] = "encrypt_test.db";
+
+  //The size of the plaintext of each chunk and of the buffers of the writer
+  constexpr size_t CHUNK_SIZE = 64 * 1024;
+  constexpr size_t PIECE_SIZE = 4 * 1024 * 1024;
+
+  const size_t SIZES[] = {
+    0,
+    1,
+    CHUNK_SIZE - 1,
+    CHUNK_SIZE,
+    CHUNK_SIZE + 1,
+    5 * CHUNK_SIZE + 123,
+    PIECE_SIZE,
+    PIECE_SIZE + CHUNK_SIZE + 7
+  };
+
+  //Deriving a key with the default cost would make the test slow
+  Key testKey(const char *phrase) {
+    return generateKey(phrase, newKeyParams({64, 1, 1}));
+  }
+
+  //Words with random bytes in between so that LZ4 has something to do
+  std::string makePlaintext(const size_t size) {
+    std::mt19937 gen(static_cast<unsigned>(size));
+    std::string str;
+    str.reserve(size);
+    while (str.size() < size) {
+      if (gen() % 4 == 0) {
+        str.push_back(static_cast<char>(gen()));
+      } else {
+        str.append("password ");
+      }
+    }
+    str.resize(size);
+    return str;
+  }
+
+  //The plaintext is written in uneven pieces
+  void writeFile(
+    const Key &key,
+    const std::string &plaintext,
+    const Compression compression
+  ) {
+    EncryptedWriter writer(key, PATH, compression);
+    std::mt19937 gen(42);
+    for (size_t pos = 0; pos != plaintext.size();) {
+      const size_t size = std::min<size_t>(gen() % (3 * CHUNK_SIZE), plaintext.size() - pos);
+      writer.write(View(plaintext).substr(pos, size));
+      pos += size;
+    }
+    writer.finish();
+  }
+
+  bool fail(const char *what, const size_t size, const Compression compression) {
+    std::cout << what << " with " << size << " bytes";
+    if (compression == Compression::lz4) {
+      std::cout << " and compression";
+    }
+    std::cout << '\n';
+    return false;
+  }
+
+  bool checkRoundTrip(
+    const Key &key,
+    const size_t size,
+    const Compression compression
+  ) {
+    const std::string plaintext = makePlaintext(size);
+    writeFile(key, plaintext, compression);
+
+    if (decryptFile(key, PATH) != plaintext) {
+      return fail("The decrypted file is different", size, compression);
+    }
+    if (readCompression(PATH) != compression) {
+      return fail("The compression in the header is wrong", size, compression);
+    }
+    auto reader = ChunkReader::open(key, PATH);
+    if (!reader) {
+      return fail("The chunk directory wasn't authentic", size, compression);
+    }
+    if (
+      reader->size() != size ||
+      reader->directory().chunks.size() != (size + CHUNK_SIZE - 1) / CHUNK_SIZE
+    ) {
+      return fail("The chunk directory is wrong", size, compression);
+    }
+    if (!reader->modifiedChunks().empty()) {
+      return fail("An unmodified chunk was reported", size, compression);
+    }
+
+    //ranges that start and end in different chunks
+    std::mt19937 gen(7);
+    for (size_t r = 0; r != 32 && size != 0; ++r) {
+      const size_t offset = gen() % size;
+      const size_t length = std::min<size_t>(gen() % (2 * CHUNK_SIZE), size - offset);
+      if (reader->read(offset, length) != View(plaintext).substr(offset, length)) {
+        return fail("A range of the file is wrong", size, compression);
+      }
+    }
+    return true;
+  }
+
+  bool checkWrongKey(const Key &key, const Key &wrongKey) {
+    writeFile(key, makePlaintext(3 * CHUNK_SIZE), Compression::none);
+    if (ChunkReader::open(wrongKey, PATH)) {
+      std::cout << "The directory was authentic with the wrong key\n";
+      return false;
+    }
+    try {
+      decryptFile(wrongKey, PATH);
+    } catch (std::runtime_error &) {
+      return true;
+    }
+    std::cout << "The file was decrypted with the wrong key\n";
+    return false;
+  }
+
+  void flipByte(const size_t offset) {
+    std::FILE *file = std::fopen(PATH, "r+b");
+    std::fseek(file, static_cast<long>(offset), SEEK_SET);
+    const int byte = std::fgetc(file);
+    std::fseek(file, static_cast<long>(offset), SEEK_SET);
+    std::fputc(byte ^ 1, file);
+    std::fclose(file);
+  }
+
+  bool checkTamper(const Key &key, const Compression compression) {
+    const size_t size = 5 * CHUNK_SIZE + 123;
+    const size_t modified = 2;
+    writeFile(key, makePlaintext(size), compression);
+
+    size_t offset;
+    {
+      const auto reader = ChunkReader::open(key, PATH);
+      const ChunkInfo &info = reader->directory().chunks[modified];
+      offset = info.offset + info.size / 2;
+    }
+    flipByte(offset);
+
+    auto reader = ChunkReader::open(key, PATH);
+    if (!reader) {
+      return fail("Flipping a chunk made the directory invalid", size, compression);
+    }
+    if (reader->modifiedChunks() != std::vector<size_t>{modified}) {
+      return fail("The flipped chunk wasn't the one reported", size, compression);
+    }
+    //the chunks before it can still be read
+    reader->read(0, modified * CHUNK_SIZE);
+    try {
+      reader->chunk(modified);
+    } catch (std::runtime_error &) {
+      try {
+        decryptFile(key, PATH);
+      } catch (std::runtime_error &) {
+        return true;
+      }
+    }
+    return fail("The flipped chunk was decrypted", size, compression);
+  }
+}
+
+int main() {
+  const Key key = testKey("phrase");
+  const Key wrongKey = testKey("wrong phrase");
+
+  bool passed = true;
+  for (const Compression compression : {Compression::none, Compression::lz4}) {
+    for (const size_t size : SIZES) {
+      passed &= checkRoundTrip(key, size, compression);
+    }
+    passed &= checkTamper(key, compression);
+  }
+  passed &= checkWrongKey(key, wrongKey);
+
+  std::remove(PATH);
+  if (passed) {
+    std::cout << "Every file was read back\n";
+  }
+  return passed ? 0 : 1;
+}
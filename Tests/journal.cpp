@@ -0,0 +1,273 @@
+//
+//  journal.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 21/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "../Sources/journal.hpp"
+
+#include <map>
+#include <cstdio>
+#include <iostream>
+
+//Changes are recorded in the journal of a database file and replayed after
+//it's reopened. Records that were cut off or belong to another file are
+//dropped and records that were modified are rejected. The journal of a file
+//that was compacted has to give every change to whichever file is there after
+//a crash
+
+namespace {
+  using View = std::experimental::string_view;
+  using Entries = std::map<std::string, std::string>;
+
+  const char DB_PATH[] = "journal_test.db";
+  const char JOURNAL_PATH[] = "journal_test.db.journal";
+
+  //Deriving a key with the default cost would make the test slow
+  Key testKey(const char *phrase) {
+    return generateKey(phrase, newKeyParams({64, 1, 1}));
+  }
+
+  //Replaces the database file and returns its nonce
+  uint64_t writeDatabase(const Key &key) {
+    EncryptedWriter writer(key, DB_PATH);
+    writer.finish();
+    return writer.fileNonce();
+  }
+
+  Entries replayed(Journal &journal, Entries entries) {
+    Passwords passwords;
+    for (const auto &entry : entries) {
+      passwords.emplace(entry.first, entry.second);
+    }
+    journal.replay(passwords);
+    entries.clear();
+    for (const Passwords::Entry &entry : passwords) {
+      entries.emplace(entry.first.to_string(), entry.second.to_string());
+    }
+    return entries;
+  }
+
+  std::string readFile(const char *path) {
+    std::string contents;
+    std::FILE *file = std::fopen(path, "rb");
+    if (file == nullptr) {
+      return contents;
+    }
+    char buf[4096];
+    size_t size;
+    while ((size = std::fread(buf, 1, sizeof(buf), file)) != 0) {
+      contents.append(buf, size);
+    }
+    std::fclose(file);
+    return contents;
+  }
+
+  void writeFile(const char *path, const std::string &contents) {
+    std::FILE *file = std::fopen(path, "wb");
+    std::fwrite(contents.data(), 1, contents.size(), file);
+    std::fclose(file);
+  }
+
+  bool checkReplay(const Key &key, const uint64_t nonce) {
+    std::remove(JOURNAL_PATH);
+    {
+      Journal journal(DB_PATH, key, nonce);
+      journal.set("a", "1");
+      journal.set("b", "2");
+      journal.rename("a", "c", "3");
+      journal.remove("b");
+      journal.set("d", "4");
+    }
+
+    Journal journal(DB_PATH, key, nonce);
+    if (journal.records() != 5) {
+      std::cout << "The journal has " << journal.records() << " records after it was reopened\n";
+      return false;
+    }
+    const Entries expected = {{"c", "3"}, {"d", "4"}, {"e", "5"}};
+    if (replayed(journal, {{"b", "old"}, {"e", "5"}}) != expected) {
+      std::cout << "The changes weren't replayed\n";
+      return false;
+    }
+    return true;
+  }
+
+  bool checkCutOff(const Key &key, const uint64_t nonce) {
+    std::remove(JOURNAL_PATH);
+    {
+      Journal journal(DB_PATH, key, nonce);
+      journal.set("a", "1");
+      journal.set("b", "2");
+    }
+    const size_t whole = readFile(JOURNAL_PATH).size();
+    {
+      Journal journal(DB_PATH, key, nonce);
+      journal.set("c", "3");
+    }
+    //a crash in the middle of appending the last record
+    std::string journalBytes = readFile(JOURNAL_PATH);
+    journalBytes.resize(journalBytes.size() - 5);
+    writeFile(JOURNAL_PATH, journalBytes);
+
+    Journal journal(DB_PATH, key, nonce);
+    if (journal.records() != 2 || journal.size() != whole) {
+      std::cout << "The record that was cut off wasn't dropped\n";
+      return false;
+    }
+    if (readFile(JOURNAL_PATH).size() != whole) {
+      std::cout << "The journal wasn't rewritten without the record that was cut off\n";
+      return false;
+    }
+    const Entries expected = {{"a", "1"}, {"b", "2"}};
+    if (replayed(journal, {}) != expected) {
+      std::cout << "The records before the one that was cut off weren't replayed\n";
+      return false;
+    }
+    return true;
+  }
+
+  bool rejected(const Key &key, const uint64_t nonce, const std::string &journal) {
+    try {
+      openRecords(key, nonce, journal);
+    } catch (std::runtime_error &) {
+      return true;
+    }
+    return false;
+  }
+
+  bool checkModified(const Key &key, const uint64_t nonce) {
+    const std::string first = sealRecord(key, nonce, 0, "first");
+    const std::string second = sealRecord(key, nonce, 1, "second");
+
+    const JournalRecords records = openRecords(key, nonce, first + second);
+    if (
+      records.stale ||
+      records.records != std::vector<std::string>{"first", "second"}
+    ) {
+      std::cout << "The records weren't opened\n";
+      return false;
+    }
+
+    std::string tampered = first + second;
+    tampered[first.size() + second.size() / 2] ^= 1;
+    if (!rejected(key, nonce, tampered)) {
+      std::cout << "A modified record was accepted\n";
+      return false;
+    }
+    if (!rejected(key, nonce, second + first)) {
+      std::cout << "Records in the wrong order were accepted\n";
+      return false;
+    }
+    if (!rejected(key, nonce, second)) {
+      std::cout << "A missing record wasn't noticed\n";
+      return false;
+    }
+
+    writeFile(JOURNAL_PATH, tampered);
+    try {
+      Journal journal(DB_PATH, key, nonce);
+    } catch (std::runtime_error &) {
+      return true;
+    }
+    std::cout << "A modified journal was opened\n";
+    return false;
+  }
+
+  bool checkCompaction(const Key &key, const uint64_t nonce) {
+    std::remove(JOURNAL_PATH);
+    //the phrase can change when the database is compacted
+    const Key newKey = testKey("new phrase");
+    const uint64_t newNonce = nonce + 1;
+    {
+      Journal journal(DB_PATH, key, nonce);
+      journal.set("a", "1");
+      journal.beginCompaction(newKey, newNonce, true);
+      journal.set("b", "2");
+
+      if (readJournalRecords(DB_PATH, key, nonce).size() != 2) {
+        std::cout << "A change wasn't recorded for the file being compacted\n";
+        return false;
+      }
+      journal.finishCompaction();
+      journal.set("c", "3");
+      if (journal.records() != 2) {
+        std::cout << "The journal has " << journal.records() << " records after compaction\n";
+        return false;
+      }
+    }
+
+    if (!readJournalRecords(DB_PATH, key, nonce).empty()) {
+      std::cout << "The records for the old file weren't dropped\n";
+      return false;
+    }
+    Journal journal(DB_PATH, newKey, newNonce);
+    const Entries expected = {{"b", "2"}, {"c", "3"}};
+    if (replayed(journal, {}) != expected) {
+      std::cout << "The records for the new file weren't kept\n";
+      return false;
+    }
+    return true;
+  }
+
+  //The database file is replaced but the program stops before the journal is
+  //rewritten for it
+  bool checkCrash(const Key &key, const uint64_t nonce) {
+    std::remove(JOURNAL_PATH);
+    uint64_t newNonce;
+    {
+      Journal journal(DB_PATH, key, nonce);
+      journal.set("a", "1");
+
+      EncryptedWriter writer(key, DB_PATH);
+      newNonce = writer.fileNonce();
+      journal.beginCompaction(key, newNonce, true);
+      journal.set("b", "2");
+
+      //a crash before the file is replaced
+      const std::vector<std::string> old = readJournalRecords(DB_PATH, key, nonce);
+      const JournalChange change = findChange(old, "b");
+      if (old.size() != 2 || !change.password || *change.password != "2") {
+        std::cout << "The old file doesn't get every change\n";
+        return false;
+      }
+
+      writer.finish();
+    }
+
+    const auto fileNonce = readFileNonce(DB_PATH);
+    if (!fileNonce || *fileNonce != newNonce) {
+      std::cout << "The database file wasn't replaced\n";
+      return false;
+    }
+    Journal journal(DB_PATH, key, *fileNonce);
+    //a was written to the new file
+    const Entries expected = {{"a", "1"}, {"b", "2"}};
+    if (replayed(journal, {{"a", "1"}}) != expected || journal.records() != 1) {
+      std::cout << "The change made during compaction was lost\n";
+      return false;
+    }
+    return true;
+  }
+}
+
+int main() {
+  const Key key = testKey("phrase");
+  const uint64_t nonce = writeDatabase(key);
+
+  bool passed = true;
+  passed &= checkReplay(key, nonce);
+  passed &= checkCutOff(key, nonce);
+  passed &= checkModified(key, nonce);
+  passed &= checkCompaction(key, nonce);
+  passed &= checkCrash(key, writeDatabase(key));
+
+  std::remove(DB_PATH);
+  std::remove(JOURNAL_PATH);
+  if (passed) {
+    std::cout << "Every change was replayed\n";
+  }
+  return passed ? 0 : 1;
+}
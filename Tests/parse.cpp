@@ -0,0 +1,91 @@
+//
+//  parse.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 21/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "../Sources/parse.hpp"
+#include "../Sources/parallel.hpp"
+
+#include <new>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+
+//Opening a file shouldn't allocate for every entry. The entries point into the
+//decrypted file and the table is reserved up front so the number of
+//allocations only depends on the number of threads
+
+namespace {
+  std::atomic<size_t> allocations{0};
+  
+  constexpr size_t SMALL_ENTRIES = 1000;
+  constexpr size_t LARGE_ENTRIES = 100000;
+  
+  std::string makeFile(const size_t entries, const Layout layout) {
+    Passwords passwords;
+    passwords.setLayout(layout);
+    passwords.reserve(entries);
+    for (size_t e = 0; e != entries; ++e) {
+      const std::string name = "entry " + std::to_string(e);
+      const std::string password = "password " + std::to_string(e * 7919);
+      passwords.emplace(name, password);
+    }
+    std::string file;
+    writePasswords(passwords, [&file] (const std::experimental::string_view str) {
+      file.append(str.data(), str.size());
+    });
+    return file;
+  }
+  
+  //The number of allocations made while the file is read
+  size_t countAllocations(const size_t entries, const Layout layout) {
+    std::string file = makeFile(entries, layout);
+    const size_t before = allocations;
+    const Passwords passwords = readPasswords(std::move(file));
+    const size_t after = allocations;
+    if (passwords.size() != entries) {
+      std::cout << "Read " << passwords.size() << " of " << entries << " entries\n";
+      std::exit(1);
+    }
+    return after - before;
+  }
+  
+  bool checkLayout(const Layout layout, const char *name) {
+    //each thread needs a few allocations for itself and its share of the
+    //entries
+    const size_t limit = 32 + 8 * parallelThreads();
+    const size_t small = countAllocations(SMALL_ENTRIES, layout);
+    const size_t large = countAllocations(LARGE_ENTRIES, layout);
+    std::cout << "Reading " << SMALL_ENTRIES << " " << name << " entries made "
+              << small << " allocations\n";
+    std::cout << "Reading " << LARGE_ENTRIES << " " << name << " entries made "
+              << large << " allocations\n";
+    return small <= limit && large <= limit;
+  }
+}
+
+void *operator new(const size_t size) {
+  ++allocations;
+  if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  std::free(ptr);
+}
+
+int main() {
+  bool passed = true;
+  passed &= checkLayout(Layout::legacy, "legacy");
+  passed &= checkLayout(Layout::indexed, "indexed");
+  return passed ? 0 : 1;
+}
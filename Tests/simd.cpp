@@ -0,0 +1,121 @@
+//
+//  simd.cpp
+//  Pass Man
+//
+//  Created by Indi Kernick on 21/8/17.
+//  Copyright © 2017 Indi Kernick. All rights reserved.
+//
+
+#include "../Sources/simd.hpp"
+
+#include <vector>
+#include <random>
+#include <iostream>
+
+//Every kernel that the CPU supports has to give the same result as the
+//scalar kernel. The offsets and sizes are chosen so that each kernel has to
+//handle unaligned data and the bytes left over after its widest loop
+
+namespace {
+  constexpr size_t MAX_OFFSET = 130;
+  constexpr size_t MAX_SIZE = 130;
+  
+  const SimdKernel KERNELS[] = {
+    SimdKernel::sse2,
+    SimdKernel::avx2,
+    SimdKernel::avx512
+  };
+  
+  const char *kernelName(const SimdKernel kernel) {
+    switch (kernel) {
+      case SimdKernel::scalar:
+        return "scalar";
+      case SimdKernel::sse2:
+        return "SSE2";
+      case SimdKernel::avx2:
+        return "AVX2";
+      case SimdKernel::avx512:
+        return "AVX-512";
+    }
+    return "";
+  }
+  
+  bool checkXor(
+    const SimdKernel kernel,
+    const std::vector<char> &src,
+    const std::vector<uint8_t> &keystream
+  ) {
+    std::vector<char> expected(MAX_OFFSET + MAX_SIZE);
+    std::vector<char> actual(MAX_OFFSET + MAX_SIZE);
+    for (size_t offset = 0; offset <= MAX_OFFSET; ++offset) {
+      for (size_t size = 0; size <= MAX_SIZE; ++size) {
+        std::fill(expected.begin(), expected.end(), 0);
+        std::fill(actual.begin(), actual.end(), 0);
+        xorBytes(
+          SimdKernel::scalar, expected.data() + offset,
+          src.data() + offset, keystream.data() + offset, size
+        );
+        xorBytes(
+          kernel, actual.data() + offset,
+          src.data() + offset, keystream.data() + offset, size
+        );
+        if (expected != actual) {
+          std::cout << kernelName(kernel) << " xorBytes is wrong with offset "
+                    << offset << " and size " << size << '\n';
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+  
+  bool checkBitmap(const SimdKernel kernel, const std::vector<char> &src) {
+    constexpr size_t WORDS = (MAX_SIZE + 63) / 64;
+    for (size_t offset = 0; offset <= MAX_OFFSET; ++offset) {
+      for (size_t size = 0; size <= MAX_SIZE; ++size) {
+        uint64_t expected[WORDS] = {};
+        uint64_t actual[WORDS] = {};
+        const size_t expectedCount = byteBitmap(
+          SimdKernel::scalar, expected, src.data() + offset, size, '\0'
+        );
+        const size_t actualCount = byteBitmap(
+          kernel, actual, src.data() + offset, size, '\0'
+        );
+        if (
+          expectedCount != actualCount ||
+          !std::equal(expected, expected + WORDS, actual)
+        ) {
+          std::cout << kernelName(kernel) << " byteBitmap is wrong with offset "
+                    << offset << " and size " << size << '\n';
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+}
+
+int main() {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> dist(0, 255);
+  std::vector<char> src(MAX_OFFSET + MAX_SIZE);
+  std::vector<uint8_t> keystream(MAX_OFFSET + MAX_SIZE);
+  for (size_t i = 0; i != src.size(); ++i) {
+    //about one byte in eight is a null character
+    const int value = dist(gen);
+    src[i] = value < 32 ? '\0' : static_cast<char>(value);
+    keystream[i] = static_cast<uint8_t>(dist(gen));
+  }
+  
+  bool passed = true;
+  for (const SimdKernel kernel : KERNELS) {
+    if (!kernelSupported(kernel)) {
+      std::cout << kernelName(kernel) << " isn't supported\n";
+      continue;
+    }
+    passed &= checkXor(kernel, src, keystream);
+    passed &= checkBitmap(kernel, src);
+    std::cout << kernelName(kernel) << " was checked\n";
+  }
+  return passed ? 0 : 1;
+}